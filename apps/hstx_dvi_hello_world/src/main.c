@@ -19,6 +19,10 @@ hstx_dvi_row_t* HSTX_DVI_MEM_LOC(hstx_dvi_get_pixel_row)(uint32_t row_index) {
 
 int main(void) {
 
+    // The frame buffer is static so drive the HSTX from a ring of DMA control
+    // blocks; the IRQ then only fires every 32 blocks.
+    hstx_dvi_set_dma_ring(64);
+
     hstx_dvi_init(hstx_dvi_get_pixel_row);
 
     while (1)
@@ -17,13 +17,22 @@
 
 void __not_in_flash_func(render_loop)() {
 
+    // A late row costs the missed lines rather than the rest of the frame,
+    // the queue throws away the rows that were meant for them
+    hstx_dvi_set_underflow_policy(HSTX_DVI_UNDERFLOW_BORDER);
     hstx_dvi_init(hstx_dvi_row_fifo_get_row_fetcher());
 
-    uint32_t k = 0;
+    uint32_t frame;
+    uint32_t k;
+    hstx_dvi_row_fifo_get_expected(&frame, &k);
     uint32_t f = 200;
     while (1)
     {
-        hstx_dvi_row_t *r = hstx_dvi_row_buf_get();
+        if (hstx_dvi_row_fifo_is_stale(frame, k)) {
+            // Catch up with the scan-out
+            hstx_dvi_row_fifo_get_expected(&frame, &k);
+        }
+        hstx_dvi_row_t *r = hstx_dvi_row_buf_acquire();
         const uint32_t k1 = k & 0xff;
         for (uint32_t j = 0; j < MODE_H_ACTIVE_PIXELS >> 1; ++j)
         {
@@ -36,14 +45,17 @@ void __not_in_flash_func(render_loop)() {
                 hstx_dvi_pixel_rgb(k1,j2&0xff,(k+j2)&0xff)    
             );
         }
-        hstx_dvi_row_fifo_put_blocking(r);
+        hstx_dvi_row_fifo_put_blocking(r, frame, k);
         k++;
         // Test we can recover from a FIFO underflow
         if (k == 470 && f > 0) {
             f--;
             sleep_ms(10);
         }
-        if (k >= MODE_V_ACTIVE_LINES) k = 0;
+        if (k >= MODE_V_ACTIVE_LINES) {
+            k = 0;
+            ++frame;
+        }
     }
 }
 
@@ -64,7 +76,21 @@ int main(void)
     printf("HSTX DVI Row FIFO Test\n");
 
     // Initialize the HSTX DVI row FIFO.
-    hstx_dvi_row_fifo_init1(pio0);
+    hstx_dvi_row_fifo_init();
 
     multicore_launch_core1(render_loop);
+
+    // Report the DMA IRQ rate
+    uint32_t irqs = 0;
+    uint32_t frames = 0;
+    while (1) {
+        sleep_ms(1000);
+        const uint32_t i = hstx_dvi_get_irq_count();
+        const uint32_t f = hstx_dvi_get_frame_count();
+        if (f != frames) {
+            printf("IRQs per frame %lu\n", (i - irqs) / (f - frames));
+        }
+        irqs = i;
+        frames = f;
+    }
 }
@@ -77,14 +77,14 @@ void __not_in_flash_func(inv_bombs_update)() {
     }
 }
 
-void inv_bombs_fire(SpriteId invSpriteId) {
+void inv_bombs_fire(int32_t x, int32_t y) {
 	for (uint32_t i = 0; i < INV_BOMB_COUNT; ++i)
 	{
 		SpriteId si = _sprite_index + i;
 		Sprite *sprite = hstx_dvi_sprite_get(si);
 		if (!(sprite->f & SF_ENABLE)) { // If the bullet is not enabled
-			sprite->x = 4 + hstx_dvi_sprite_get(invSpriteId)->x; // Set bullet x to gun x
-			sprite->y = hstx_dvi_sprite_get(invSpriteId)->y + 8; // Set bullet y above the gun
+			sprite->x = 4 + x; // Set bullet x to invader x
+			sprite->y = y + 8; // Set bullet y below the invader
 			sprite->f |= SF_ENABLE; // Enable the bullet
 			break; // Exit after firing one bullet
 		}
@@ -11,7 +11,8 @@ SpriteId inv_bombs_init(SpriteId start);
 
 void inv_bombs_update(void);
 
-void inv_bombs_fire(SpriteId invSpriteId);
+// Drop a bomb from under the invader at x, y
+void inv_bombs_fire(int32_t x, int32_t y);
 
 #ifdef __cplusplus
 }
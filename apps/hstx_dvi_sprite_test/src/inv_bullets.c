@@ -2,6 +2,7 @@
 #include "inv_pallet.h"
 #include "inv_collisions.h"
 #include "inv_base.h"
+#include "inv_invaders.h"
 
 #define INV_BULLET_COUNT 5
 
@@ -55,6 +56,9 @@ void __not_in_flash_func(inv_bullets_update)() {
 				if (m & INV_BASE_COLLISION_MASKS) {
 					inv_base_bullet_hit(si, m); // Notify the base of the bomb hit
 				}
+				if (m & INV_INVADER_COLLISION_MASK) {
+					inv_invaders_bullet_hit(si); // Find the invader it hit
+				}
 				hstx_dvi_sprite_disable_1(sprite); // Disable the bullet if it was previously enabled
 			}
 			else {
@@ -9,6 +9,12 @@
 #define INV_INVADER_COLS 22
 #define INV_INVADER_ROWS 10
 #define INV_INVADER_COUNT (INV_INVADER_COLS * INV_INVADER_ROWS)
+#define INV_INVADER_WORDS ((INV_INVADER_COUNT + 31) >> 5)
+#define INV_INVADER_DX 16
+#define INV_INVADER_DY 16
+#define INV_INVADER_Y 60
+// The tile a cell shows while it explodes
+#define INV_TILE_EXPLOSION 7
 
 typedef enum  {
 	INV_STATE_WALK = 0,
@@ -25,15 +31,25 @@ static SpriteId _inv_index = 0;
 static int32_t inv_v = 1;
 static InvInvaderState_t _inv_state[INV_INVADER_COUNT];
 static uint32_t _last_fire_col = 0;
+static uint32_t _inv_frame = 0;
+// Where the formation was before this frame's move, which is where the
+// bullets that hit it saw it
+static int32_t _inv_drawn_x = 0;
+
+// The formation is one sprite drawing a group of cells
+static SpriteGroup _inv_group;
+static uint8_t _inv_frames[INV_INVADER_COUNT];
+static uint32_t _inv_alive[INV_INVADER_WORDS];
+static hstx_dvi_pixel_t _inv_colours[INV_INVADER_ROWS];
 
 const static uint8_t _inv_row_score[INV_INVADER_ROWS] = {
     20,20,10,10,10,10,5,5,5,5
 };
 
-__force_inline static const uint32_t get_score_for_sprite(const uint32_t index) {
-    const uint32_t row = index / INV_INVADER_COLS;
-    return _inv_row_score[row];
-}
+// The first of each row's pair of walking tiles
+const static uint8_t _inv_row_tile[INV_INVADER_ROWS] = {
+    0,0,2,2,2,2,4,4,4,4
+};
 
 static void __not_in_flash_func(sprite_renderer_invader_16x8_p1)(
 	const void* d1,
@@ -124,10 +140,7 @@ static Tile16x8p2_t tile16x8p2_invaders[] = {
 		0b1111111111111111,
 		0b0011100110011100,
 		0b0001000000001000,
-	}}
-};
-
-static Tile16x8p2_t tile16x8p2_invader_explosion[] = {
+	}},
 	{{
 		0b0000010001000000,
 		0b0010001010001000,
@@ -140,16 +153,11 @@ static Tile16x8p2_t tile16x8p2_invader_explosion[] = {
 	}},
 };
 
-static void inv_invader_explode(const uint32_t index, const uint32_t frame) {
-	const SpriteId spriteId = _inv_index + index;
-	Sprite *sprite = hstx_dvi_sprite_get(spriteId);
-	if (sprite->f & SF_ENABLE) {
-		// Set the sprite to explode
-		sprite->r = sprite_renderer_sprite_16x8_p1;
-		sprite->d1 = &tile16x8p2_invader_explosion[0];
-		sprite->d2 = inv_pallet_white();
+static void inv_invader_explode(const uint32_t index) {
+	if (_inv_state[index].state == INV_STATE_WALK) {
+		_inv_frames[index] = INV_TILE_EXPLOSION;
 		_inv_state[index].state = INV_STATE_EXPLODE;
-		_inv_state[index].end = frame + 10; 
+		_inv_state[index].end = _inv_frame + 10;
 	}
 }
 
@@ -203,7 +211,6 @@ SpriteId inv_invaders_init_title(SpriteId start) {
 SpriteId inv_invaders_init(SpriteId start) {
     _inv_index = start;
 
-	uint32_t rt[5] = {0, 2, 2, 4, 4};
 	hstx_dvi_pixel_t* rp[5] = {
         inv_pallet_white(),
         inv_pallet_blue(),
@@ -212,34 +219,65 @@ SpriteId inv_invaders_init(SpriteId start) {
         inv_pallet_purple()
     };
 
-	uint32_t i = 0;
 	for(uint32_t y = 0; y < INV_INVADER_ROWS; ++y) {
-        for(uint32_t x = 0; x < INV_INVADER_COLS; ++x, ++i) {
-		    const SpriteId si = _inv_index + i;
-            // Create the invader sprite
-			init_sprite(
-                si,
-                x << 4,
-                60 + (y << 4),
-                16,
-                8,
-                SF_ENABLE,
-                &tile16x8p2_invaders[rt[y>>1]],
-                rp[y >> 1],
-                sprite_renderer_invader_16x8_p1);
+		_inv_colours[y] = rp[y >> 1][0];
+	}
+	for(uint32_t i = 0; i < INV_INVADER_COUNT; ++i) {
+		_inv_frames[i] = _inv_row_tile[i / INV_INVADER_COLS];
+		// Initialize the invader states
+		_inv_state[i].state = INV_STATE_WALK;
+		_inv_state[i].end = 0;
+	}
+	for(uint32_t i = 0; i < INV_INVADER_WORDS; ++i) {
+		_inv_alive[i] = 0;
+	}
+	for(uint32_t i = 0; i < INV_INVADER_COUNT; ++i) {
+		_inv_alive[i >> 5] |= 1u << (i & 31);
+	}
 
-			hstx_dvi_sprite_set_sprite_collision_mask(si, INV_INVADER_COLLISION_MASK);
+	_inv_group.cols = INV_INVADER_COLS;
+	_inv_group.rows = INV_INVADER_ROWS;
+	_inv_group.dx = INV_INVADER_DX;
+	_inv_group.dy = INV_INVADER_DY;
+	_inv_group.w = 16;
+	_inv_group.h = 8;
+	_inv_group.tiles = tile16x8p2_invaders;
+	_inv_group.frames = _inv_frames;
+	_inv_group.alive = _inv_alive;
+	_inv_group.colours = _inv_colours;
 
-			// Initialize the invader states
-			_inv_state[i].state = INV_STATE_WALK;
-			_inv_state[i].end = 0;
-		}
-	}
+	// Create the formation sprite
+	init_sprite_group(
+		_inv_index,
+		0,
+		INV_INVADER_Y,
+		SF_ENABLE,
+		&_inv_group,
+		inv_pallet_white(),
+		sprite_renderer_group_16_p1);
+
+	hstx_dvi_sprite_set_sprite_collision_mask(_inv_index, INV_INVADER_COLLISION_MASK);
+	_inv_drawn_x = 0;
 
 	// Set the invaders to move right
 	inv_v = 1;
 
-    return start + INV_INVADER_COUNT;
+    return start + 1;
+}
+
+void __not_in_flash_func(inv_invaders_bullet_hit)(SpriteId bulletId) {
+	const Sprite* bullet = hstx_dvi_sprite_get(bulletId);
+	Sprite drawn = *hstx_dvi_sprite_get(_inv_index);
+	drawn.x = _inv_drawn_x;
+	// The bullet is a line down its left edge, and may only reach into one
+	// row of cells
+	for (int32_t r = 0; r < 8; ++r) {
+		const int32_t i = hstx_dvi_sprite_group_cell_at(&drawn, bullet->x, bullet->y + r);
+		if (i >= 0 && _inv_state[i].state == INV_STATE_WALK) {
+			inv_invader_explode(i);
+			break;
+		}
+	}
 }
 
 void __not_in_flash_func(inv_invader_update)(uint32_t frame) {
@@ -249,46 +287,41 @@ void __not_in_flash_func(inv_invader_update)(uint32_t frame) {
         inv_lowest[i] = -1;
     }
 
+	_inv_frame = frame;
+	Sprite *sprite = hstx_dvi_sprite_get(_inv_index);
+	_inv_drawn_x = sprite->x;
+	sprite->x += inv_v;
+	const uint32_t walk = (sprite->x >> 2) & 1;
+
     bool reverse = false;
 	uint32_t i = 0;
 	for(uint32_t y = 0; y < INV_INVADER_ROWS; ++y) {
         for(uint32_t x = 0; x < INV_INVADER_COLS; ++x, ++i) {
 			InvInvaderState_t* state = &_inv_state[i];
-		    const SpriteId si = _inv_index + i;
-			Sprite *sprite = hstx_dvi_sprite_get(si);
 			switch (state->state) {
 				case INV_STATE_WALK: {
-					sprite->x += inv_v;
-					if (sprite->f & SF_ENABLE) {
-						if (_spriteCollisions.m[si]) {
-							inv_invader_explode(i, frame);
-						}
-						else {
-							if (inv_v > 0) {
-								if(sprite->x + 16 >= MODE_H_ACTIVE_PIXELS) reverse = true;
-							}
-							else {
-								if(sprite->x <= 0) reverse = true;
-							}
-
-							if ((inv_lowest[x] == -1) || (hstx_dvi_sprite_get(inv_lowest[x])->y < sprite->y)) {
-								inv_lowest[x] = si;
-							}
-						}
+					_inv_frames[i] = _inv_row_tile[y] + walk;
+					const int32_t cx = sprite->x + x * INV_INVADER_DX;
+					if (inv_v > 0) {
+						if(cx + 16 >= MODE_H_ACTIVE_PIXELS) reverse = true;
+					}
+					else {
+						if(cx <= 0) reverse = true;
 					}
+					// Rows go down the screen, so the last is the lowest
+					inv_lowest[x] = i;
 					break;
 				}
 				case INV_STATE_EXPLODE: {
-					sprite->x += inv_v;
 					if ((int32_t)(state->end - frame) < 0) {
 						state->state = INV_STATE_DEAD;
-						hstx_dvi_sprite_disable_1(hstx_dvi_sprite_get(si));
-						inv_score_add(get_score_for_sprite(si));
+						_inv_alive[i >> 5] &= ~(1u << (i & 31));
+						inv_score_add(_inv_row_score[y]);
 					}
 					break;
 				}
 				case INV_STATE_DEAD: {
-					// Do nothing, the sprite is already disabled
+					// Do nothing, the cell is already gone
 					break;
 				}
 				default: {
@@ -306,7 +339,9 @@ void __not_in_flash_func(inv_invader_update)(uint32_t frame) {
         int32_t id = inv_lowest[j];
         if (id != -1)  {
 			any_alive = true;
-            inv_bombs_fire((SpriteId)id);
+            inv_bombs_fire(
+				sprite->x + j * INV_INVADER_DX,
+				sprite->y + (id / INV_INVADER_COLS) * INV_INVADER_DY);
         }
     }
 	_last_fire_col += 3;
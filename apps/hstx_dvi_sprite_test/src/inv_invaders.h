@@ -10,6 +10,8 @@ extern "C" {
 SpriteId inv_invaders_init(SpriteId start);
 SpriteId inv_invaders_init_title(SpriteId start);
 void inv_invader_update(uint32_t frame);
+// Explode the invader a bullet that hit the formation ran into
+void inv_invaders_bullet_hit(SpriteId bulletId);
 
 #ifdef __cplusplus
 }
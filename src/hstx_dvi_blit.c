@@ -0,0 +1,49 @@
+#include "hstx_dvi_blit.h"
+
+#define BLIT_REV2(N) (N), (N) + 0x80, (N) + 0x40, (N) + 0xc0
+#define BLIT_REV4(N) BLIT_REV2(N), BLIT_REV2((N) + 0x20), BLIT_REV2((N) + 0x10), BLIT_REV2((N) + 0x30)
+#define BLIT_REV6(N) BLIT_REV4(N), BLIT_REV4((N) + 0x08), BLIT_REV4((N) + 0x04), BLIT_REV4((N) + 0x0c)
+
+uint8_t hstx_dvi_blit_rev8[256] = {
+	BLIT_REV6(0x00), BLIT_REV6(0x02), BLIT_REV6(0x01), BLIT_REV6(0x03)
+};
+
+// Each bit of a byte doubled, first pixel still in the top bit
+#define BLIT_ZOOM2(N) ( \
+	(((N) >> 7) & 1) * 0xc000u | (((N) >> 6) & 1) * 0x3000u | \
+	(((N) >> 5) & 1) * 0x0c00u | (((N) >> 4) & 1) * 0x0300u | \
+	(((N) >> 3) & 1) * 0x00c0u | (((N) >> 2) & 1) * 0x0030u | \
+	(((N) >> 1) & 1) * 0x000cu | ((N) & 1) * 0x0003u)
+#define BLIT_ZOOM2_4(N) BLIT_ZOOM2(N), BLIT_ZOOM2((N) + 1), BLIT_ZOOM2((N) + 2), BLIT_ZOOM2((N) + 3)
+#define BLIT_ZOOM2_16(N) BLIT_ZOOM2_4(N), BLIT_ZOOM2_4((N) + 4), BLIT_ZOOM2_4((N) + 8), BLIT_ZOOM2_4((N) + 12)
+#define BLIT_ZOOM2_64(N) BLIT_ZOOM2_16(N), BLIT_ZOOM2_16((N) + 16), BLIT_ZOOM2_16((N) + 32), BLIT_ZOOM2_16((N) + 48)
+
+uint16_t hstx_dvi_blit_zoom2[256] = {
+	BLIT_ZOOM2_64(0), BLIT_ZOOM2_64(64), BLIT_ZOOM2_64(128), BLIT_ZOOM2_64(192)
+};
+
+#if MODE_BITS_PER_PIXEL >= 8
+
+#if MODE_BITS_PER_PIXEL == 8
+#define BLIT_MASK(N) { \
+	(((N) >> 3) & 1) * 0x000000ffu | (((N) >> 2) & 1) * 0x0000ff00u | \
+	(((N) >> 1) & 1) * 0x00ff0000u | ((N) & 1) * 0xff000000u, \
+	(((N) >> 3) & 1) * 0x000000ffu | (((N) >> 2) & 1) * 0x0000ff00u | \
+	(((N) >> 1) & 1) * 0x00ff0000u | ((N) & 1) * 0xff000000u }
+#else
+#define BLIT_MASK(N) { \
+	(((N) >> 1) & 1) * 0x0000ffffu | ((N) & 1) * 0xffff0000u, \
+	(((N) >> 1) & 1) * 0x000000ffu | ((N) & 1) * 0x0000ff00u }
+#endif
+
+// Not const, so it is copied to SRAM with the rest of the data
+hstx_dvi_blit_mask_t hstx_dvi_blit_masks[1 << HSTX_DVI_BLIT_PIXELS] = {
+	BLIT_MASK(0), BLIT_MASK(1), BLIT_MASK(2), BLIT_MASK(3),
+#if MODE_BITS_PER_PIXEL == 8
+	BLIT_MASK(4), BLIT_MASK(5), BLIT_MASK(6), BLIT_MASK(7),
+	BLIT_MASK(8), BLIT_MASK(9), BLIT_MASK(10), BLIT_MASK(11),
+	BLIT_MASK(12), BLIT_MASK(13), BLIT_MASK(14), BLIT_MASK(15),
+#endif
+};
+
+#endif
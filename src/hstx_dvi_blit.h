@@ -0,0 +1,311 @@
+#pragma once
+
+// Word at a time blitter for 1 bit per pixel sprite and text rows.
+//
+// The sprite bits are lined up with the words of the row, then each group
+// of 4 (RGB332) or 2 (RGB565) bits is looked up in a table of pixel and id
+// masks and merged into the row and id row a word at a time. Only the
+// pixels that hit another sprite are looked at one by one.
+//
+// Rows of less than 8 bits per pixel don't line up with the id row, so the
+// sprite renderer keeps drawing those a pixel at a time. The occupancy
+// bitmap blitter (see HSTX_DVI_SPRITE_COLLISION_BITMAP) works at any depth.
+
+#include "hstx_dvi_sprite.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Colours for a multi-colour sprite row. Pixel j of the buffer is pixel
+// (x & ~31) + j of the row, so the row starts at x & 31 and the buffer
+// lines up with both the row words and the occupancy bitmap words. A null
+// buffer means every pixel is the one colour p.
+typedef union {
+	hstx_dvi_pixel_t p[64];
+	uint32_t w[(64 * sizeof(hstx_dvi_pixel_t)) >> 2];
+} hstx_dvi_blit_colours_t;
+
+// Bit reversal and bit doubling tables for flipped and zoomed sprites
+extern uint8_t hstx_dvi_blit_rev8[256];
+extern uint16_t hstx_dvi_blit_zoom2[256];
+
+// Mirror the w (1 to 32) bits of d
+static __force_inline uint32_t hstx_dvi_blit_flip(const uint32_t d, const uint32_t w) {
+	const uint32_t v =
+		((uint32_t)hstx_dvi_blit_rev8[d & 0xff] << 24) |
+		((uint32_t)hstx_dvi_blit_rev8[(d >> 8) & 0xff] << 16) |
+		((uint32_t)hstx_dvi_blit_rev8[(d >> 16) & 0xff] << 8) |
+		hstx_dvi_blit_rev8[d >> 24];
+	return v >> (32 - w);
+}
+
+// Stretch the top 32 >> z bits of s to 32 bits, each bit repeated 1 << z
+// times, for z of 1 or 2
+static __force_inline uint32_t hstx_dvi_blit_zoom(const uint32_t s, const uint32_t z) {
+	if (z == 1) {
+		return ((uint32_t)hstx_dvi_blit_zoom2[s >> 24] << 16) | hstx_dvi_blit_zoom2[(s >> 16) & 0xff];
+	}
+	const uint32_t t = hstx_dvi_blit_zoom2[s >> 24];
+	return ((uint32_t)hstx_dvi_blit_zoom2[t >> 8] << 16) | hstx_dvi_blit_zoom2[t & 0xff];
+}
+
+#if MODE_BITS_PER_PIXEL >= 8
+
+#define HSTX_DVI_BLIT_PIXELS HSTX_DVI_PIXELS_PER_WORD
+#define HSTX_DVI_BLIT_SHIFT (MODE_BITS_PER_PIXEL == 8 ? 2 : 1)
+#define HSTX_DVI_BLIT_BITS ((1u << HSTX_DVI_BLIT_PIXELS) - 1)
+#define HSTX_DVI_BLIT_WORDS (MODE_H_ACTIVE_PIXELS >> HSTX_DVI_BLIT_SHIFT)
+
+#if MODE_H_ACTIVE_PIXELS & (HSTX_DVI_BLIT_PIXELS - 1)
+#error "MODE_H_ACTIVE_PIXELS must be a whole number of row words"
+#endif
+
+// Masks for a group of sprite bits, first pixel in the top bit
+typedef struct {
+	uint32_t pixels; // the pixels in a row word
+	uint32_t ids;    // their ids in the id row
+} hstx_dvi_blit_mask_t;
+
+extern hstx_dvi_blit_mask_t hstx_dvi_blit_masks[1 << HSTX_DVI_BLIT_PIXELS];
+
+// The ids under a row word
+static __force_inline uint32_t hstx_dvi_blit_get_ids(const SpriteIdRow* idRow, const uint32_t i) {
+#if MODE_BITS_PER_PIXEL == 8
+	return idRow->word[i];
+#else
+	return idRow->half[i];
+#endif
+}
+
+static __force_inline void hstx_dvi_blit_set_ids(SpriteIdRow* idRow, const uint32_t i, const uint32_t ids) {
+#if MODE_BITS_PER_PIXEL == 8
+	idRow->word[i] = ids;
+#else
+	idRow->half[i] = ids;
+#endif
+}
+
+// Sprite bits (first pixel in the top bit) for the pixels that already
+// have an id
+static __force_inline uint32_t hstx_dvi_blit_taken(const uint32_t ids) {
+	// Top bit of each non-zero id
+	const uint32_t h = (((ids & 0x7f7f7f7fu) + 0x7f7f7f7fu) | ids) & 0x80808080u;
+#if MODE_BITS_PER_PIXEL == 8
+	// Gather bits 7, 15, 23 and 31 into bits 3, 2, 1 and 0
+	return (((h >> 7) * 0x08040201u) >> 24) & 0xf;
+#else
+	return ((h >> 6) & 2) | ((h >> 15) & 1);
+#endif
+}
+
+static __force_inline uint32_t hstx_dvi_blit_pixel_word(const hstx_dvi_pixel_t p) {
+#if MODE_BITS_PER_PIXEL == 8
+	return (uint32_t)p * 0x01010101u;
+#else
+	return (uint32_t)p * 0x00010001u;
+#endif
+}
+
+// Draw the w (1 to 32) bits of d, first pixel in bit w-1, at x in colour p
+static __force_inline void hstx_dvi_blit_row(
+	const uint32_t d,
+	const uint32_t w,
+	const hstx_dvi_pixel_t p,
+	hstx_dvi_row_t* r,
+	const int32_t x
+) {
+	const uint32_t off = (uint32_t)x & (HSTX_DVI_BLIT_PIXELS - 1);
+	const int32_t i0 = x >> HSTX_DVI_BLIT_SHIFT;
+	// First pixel in bit 63 - off, so the groups line up with the row words
+	const uint64_t bits = ((uint64_t)d << (64 - w)) >> off;
+	const uint32_t n = (off + w + HSTX_DVI_BLIT_PIXELS - 1) >> HSTX_DVI_BLIT_SHIFT;
+	const uint32_t pw = hstx_dvi_blit_pixel_word(p);
+	for (uint32_t k = 0; k < n; ++k) {
+		const uint32_t m = (uint32_t)(bits >> (64 - (HSTX_DVI_BLIT_PIXELS * (k + 1)))) & HSTX_DVI_BLIT_BITS;
+		const uint32_t i = (uint32_t)(i0 + (int32_t)k);
+		if (m && i < HSTX_DVI_BLIT_WORDS) {
+			const uint32_t pm = hstx_dvi_blit_masks[m].pixels;
+			r->w[i] = (r->w[i] & ~pm) | (pw & pm);
+		}
+	}
+}
+
+// As hstx_dvi_blit_row, but only draws on pixels with no id yet and marks
+// them with the sprite's. Pixels that already have an id record a collision
+// both ways. Colours come from c if there is one.
+static __force_inline void hstx_dvi_blit_sprite_row_c(
+	const uint32_t d,
+	const uint32_t w,
+	const hstx_dvi_pixel_t p,
+	const hstx_dvi_blit_colours_t* const c,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const SpriteId spriteId,
+	SpriteIdRow* const idRow,
+	SpriteCollisions* const collisions,
+	const SpriteCollisionMask* const masks
+) {
+	const uint32_t off = (uint32_t)x & (HSTX_DVI_BLIT_PIXELS - 1);
+	const int32_t i0 = x >> HSTX_DVI_BLIT_SHIFT;
+	const uint64_t bits = ((uint64_t)d << (64 - w)) >> off;
+	const uint32_t n = (off + w + HSTX_DVI_BLIT_PIXELS - 1) >> HSTX_DVI_BLIT_SHIFT;
+	const uint32_t pw = hstx_dvi_blit_pixel_word(p);
+	const uint32_t iw = (spriteId + 1) * 0x01010101u;
+	// The buffer word under the first row word
+	const uint32_t cw0 = ((uint32_t)x & 31) >> HSTX_DVI_BLIT_SHIFT;
+	for (uint32_t k = 0; k < n; ++k) {
+		const uint32_t m = (uint32_t)(bits >> (64 - (HSTX_DVI_BLIT_PIXELS * (k + 1)))) & HSTX_DVI_BLIT_BITS;
+		const uint32_t i = (uint32_t)(i0 + (int32_t)k);
+		if (m && i < HSTX_DVI_BLIT_WORDS) {
+			const uint32_t ids = hstx_dvi_blit_get_ids(idRow, i);
+			const uint32_t taken = hstx_dvi_blit_taken(ids);
+			const hstx_dvi_blit_mask_t* bm = &hstx_dvi_blit_masks[m & ~taken];
+			const uint32_t cw = c ? c->w[cw0 + k] : pw;
+			r->w[i] = (r->w[i] & ~bm->pixels) | (cw & bm->pixels);
+			hstx_dvi_blit_set_ids(idRow, i, ids | (iw & bm->ids));
+			const uint32_t hit = m & taken;
+			if (hit) {
+				for (uint32_t j = 0; j < HSTX_DVI_BLIT_PIXELS; ++j) {
+					if (hit & (1u << (HSTX_DVI_BLIT_PIXELS - 1 - j))) {
+						const SpriteId cid = ((ids >> (j << 3)) & 0xff) - 1;
+						collisions->m[cid] |= masks[spriteId];
+						collisions->m[spriteId] |= masks[cid];
+					}
+				}
+			}
+		}
+	}
+}
+
+static __force_inline void hstx_dvi_blit_sprite_row(
+	const uint32_t d,
+	const uint32_t w,
+	const hstx_dvi_pixel_t p,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const SpriteId spriteId,
+	SpriteIdRow* const idRow,
+	SpriteCollisions* const collisions,
+	const SpriteCollisionMask* const masks
+) {
+	hstx_dvi_blit_sprite_row_c(d, w, p, 0, r, x, spriteId, idRow, collisions, masks);
+}
+
+#endif
+
+// Pixels past the end of the row in the last bitmap word
+#if MODE_H_ACTIVE_PIXELS & 31
+#define HSTX_DVI_BLIT_OCC_LAST_MASK (~0u << (32 - (MODE_H_ACTIVE_PIXELS & 31)))
+#else
+#define HSTX_DVI_BLIT_OCC_LAST_MASK (~0u)
+#endif
+
+// Draw the pixels set in m, first pixel in the top bit, of the 32 that
+// start at pixel 32i. Colours come from half h (0 or 1) of c if there is one.
+static __force_inline void hstx_dvi_blit_bits(
+	hstx_dvi_row_t* r,
+	const uint32_t i,
+	uint32_t m,
+	const hstx_dvi_pixel_t p,
+	const hstx_dvi_blit_colours_t* const c,
+	const uint32_t h
+) {
+#if MODE_BITS_PER_PIXEL >= 8
+	const uint32_t pw = hstx_dvi_blit_pixel_word(p);
+	uint32_t* const rw = &r->w[i << (5 - HSTX_DVI_BLIT_SHIFT)];
+	const uint32_t* const cw = c ? &c->w[h << (5 - HSTX_DVI_BLIT_SHIFT)] : 0;
+	for (uint32_t k = 0; m; ++k, m <<= HSTX_DVI_BLIT_PIXELS) {
+		const uint32_t pm = hstx_dvi_blit_masks[m >> (32 - HSTX_DVI_BLIT_PIXELS)].pixels;
+		if (pm) rw[k] = (rw[k] & ~pm) | ((cw ? cw[k] : pw) & pm);
+	}
+#else
+	while (m) {
+		const uint32_t b = __builtin_clz(m);
+		hstx_dvi_row_set_pixel(r, (i << 5) + b, c ? c->p[(h << 5) + b] : p);
+		m &= ~(0x80000000u >> b);
+	}
+#endif
+}
+
+// As hstx_dvi_blit_sprite_row_c, but against an occupancy bitmap
+static __force_inline void hstx_dvi_blit_sprite_row_bitmap_c(
+	const uint32_t d,
+	const uint32_t w,
+	const hstx_dvi_pixel_t p,
+	const hstx_dvi_blit_colours_t* const c,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const SpriteId spriteId,
+	SpriteOccupancyRow* const occRow,
+	SpriteCollisions* const collisions,
+	const SpriteCollisionMask* const masks
+) {
+	const int32_t i0 = x >> 5;
+	const uint64_t bits = ((uint64_t)d << (64 - w)) >> ((uint32_t)x & 31);
+	uint32_t m[2] = { (uint32_t)(bits >> 32), (uint32_t)bits };
+	uint32_t h[2] = { 0, 0 };
+	for (uint32_t k = 0; k < 2; ++k) {
+		const uint32_t i = (uint32_t)(i0 + (int32_t)k);
+		if (i >= SPRITE_OCC_ROW_WORDS) {
+			m[k] = 0;
+			continue;
+		}
+		if (i == SPRITE_OCC_ROW_WORDS - 1) m[k] &= HSTX_DVI_BLIT_OCC_LAST_MASK;
+		const uint32_t occ = occRow->occ[i];
+		h[k] = m[k] & occ;
+		m[k] &= ~occ;
+		if (m[k]) {
+			occRow->occ[i] = occ | m[k];
+			hstx_dvi_blit_bits(r, i, m[k], p, c, k);
+		}
+	}
+	// Find who drew the pixels that were already taken, the drawn masks
+	// never overlap so each pixel has one owner
+	for (uint32_t e = 0; e < occRow->n && (h[0] | h[1]); ++e) {
+		const SpriteRowMask* const o = &occRow->drawn[e];
+		const uint32_t k = (uint32_t)((int32_t)o->i - i0);
+		if (k >= 2) continue;
+		const uint32_t hit = h[k] & o->m;
+		if (hit) {
+			collisions->m[o->id] |= masks[spriteId];
+			collisions->m[spriteId] |= masks[o->id];
+			h[k] &= ~hit;
+		}
+	}
+	// A sprite drawn in chunks has its entries last, so add to the one for
+	// the word if there is one
+	for (uint32_t k = 0; k < 2; ++k) {
+		if (!m[k]) continue;
+		const uint16_t i = (uint16_t)(i0 + (int32_t)k);
+		uint32_t e = occRow->n;
+		while (e && occRow->drawn[e - 1].id == spriteId && occRow->drawn[e - 1].i != i) --e;
+		if (e && occRow->drawn[e - 1].id == spriteId) {
+			occRow->drawn[e - 1].m |= m[k];
+		}
+		else {
+			SpriteRowMask* const o = &occRow->drawn[occRow->n++];
+			o->m = m[k];
+			o->i = i;
+			o->id = spriteId;
+		}
+	}
+}
+
+static __force_inline void hstx_dvi_blit_sprite_row_bitmap(
+	const uint32_t d,
+	const uint32_t w,
+	const hstx_dvi_pixel_t p,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const SpriteId spriteId,
+	SpriteOccupancyRow* const occRow,
+	SpriteCollisions* const collisions,
+	const SpriteCollisionMask* const masks
+) {
+	hstx_dvi_blit_sprite_row_bitmap_c(d, w, p, 0, r, x, spriteId, occRow, collisions, masks);
+}
+
+#ifdef __cplusplus
+}
+#endif
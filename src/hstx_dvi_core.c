@@ -20,6 +20,10 @@
 #include "hardware/structs/sio.h"
 #include "pico/multicore.h"
 #include "pico/sem.h"
+#if HSTX_DVI_STATS
+#include "hardware/structs/systick.h"
+#include <string.h>
+#endif
 
 #ifndef count_of
 #define count_of(arr) (sizeof(arr) / sizeof((arr)[0]))
@@ -38,59 +42,169 @@
 #define SYNC_V1_H0 (TMDS_CTRL_10 | (TMDS_CTRL_00 << 10) | (TMDS_CTRL_00 << 20))
 #define SYNC_V1_H1 (TMDS_CTRL_11 | (TMDS_CTRL_00 << 10) | (TMDS_CTRL_00 << 20))
 
-#define MODE_H_TOTAL_PIXELS ( \
-    MODE_H_FRONT_PORCH + MODE_H_SYNC_WIDTH + \
-    MODE_H_BACK_PORCH  + MODE_H_ACTIVE_PIXELS \
-)
-#define MODE_V_TOTAL_LINES  ( \
-    MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH + \
-    MODE_V_BACK_PORCH  + MODE_V_ACTIVE_LINES \
-)
-
-#define HSTX_CMD_RAW         (0x0u << 12)
-#define HSTX_CMD_RAW_REPEAT  (0x1u << 12)
-#define HSTX_CMD_TMDS        (0x2u << 12)
-#define HSTX_CMD_TMDS_REPEAT (0x3u << 12)
-#define HSTX_CMD_NOP         (0xfu << 12)
+// Sync symbol for the given sync states, taking the mode's polarity into
+// account. Active low sync idles high.
+static uint32_t sync_symbol(const hstx_dvi_mode_t* mode, const bool vsync, const bool hsync) {
+    static const uint32_t ctrl[4] = {SYNC_V0_H0, SYNC_V0_H1, SYNC_V1_H0, SYNC_V1_H1};
+    const uint32_t v = vsync == (mode->v_sync_polarity == HSTX_DVI_SYNC_POSITIVE);
+    const uint32_t h = hsync == (mode->h_sync_polarity == HSTX_DVI_SYNC_POSITIVE);
+    return ctrl[(v << 1) | h];
+}
 
 // ----------------------------------------------------------------------------
 // HSTX command lists
 
 // Lists are padded with NOPs to be >= HSTX FIFO size, to avoid DMA rapidly
-// pingponging and tripping up the IRQs.
-
-static uint32_t vblank_line_vsync_off[] = {
-    HSTX_CMD_RAW_REPEAT | MODE_H_FRONT_PORCH,
-    SYNC_V1_H1,
-    HSTX_CMD_RAW_REPEAT | MODE_H_SYNC_WIDTH,
-    SYNC_V1_H0,
-    HSTX_CMD_RAW_REPEAT | (MODE_H_BACK_PORCH + MODE_H_ACTIVE_PIXELS),
-    SYNC_V1_H1,
-    HSTX_CMD_NOP
-};
+// pingponging and tripping up the IRQs. They are filled in from the mode at
+// init.
 
-static uint32_t vblank_line_vsync_on[] = {
-    HSTX_CMD_RAW_REPEAT | MODE_H_FRONT_PORCH,
-    SYNC_V0_H1,
-    HSTX_CMD_RAW_REPEAT | MODE_H_SYNC_WIDTH,
-    SYNC_V0_H0,
-    HSTX_CMD_RAW_REPEAT | (MODE_H_BACK_PORCH + MODE_H_ACTIVE_PIXELS),
-    SYNC_V0_H1,
-    HSTX_CMD_NOP
-};
+static uint32_t vblank_line_vsync_off[7];
+static uint32_t vblank_line_vsync_on[7];
+static uint32_t vactive_line[9];
+static uint32_t vactive_line_cmds[9];
+
+static void build_vblank_line(const hstx_dvi_mode_t* mode, uint32_t* l, const bool vsync) {
+    *l++ = HSTX_CMD_RAW_REPEAT | mode->h_front_porch;
+    *l++ = sync_symbol(mode, vsync, false);
+    *l++ = HSTX_CMD_RAW_REPEAT | mode->h_sync_width;
+    *l++ = sync_symbol(mode, vsync, true);
+    *l++ = HSTX_CMD_RAW_REPEAT | (mode->h_back_porch + mode->h_active_pixels);
+    *l++ = sync_symbol(mode, vsync, false);
+    *l++ = HSTX_CMD_NOP;
+}
+
+static void build_vactive_line(const hstx_dvi_mode_t* mode, uint32_t* l) {
+    *l++ = HSTX_CMD_RAW_REPEAT | mode->h_front_porch;
+    *l++ = sync_symbol(mode, false, false);
+    *l++ = HSTX_CMD_NOP;
+    *l++ = HSTX_CMD_RAW_REPEAT | mode->h_sync_width;
+    *l++ = sync_symbol(mode, false, true);
+    *l++ = HSTX_CMD_NOP;
+    *l++ = HSTX_CMD_RAW_REPEAT | mode->h_back_porch;
+    *l++ = sync_symbol(mode, false, false);
+    *l++ = HSTX_CMD_TMDS       | mode->h_active_pixels;
+}
+
+// For rows that bring their own commands for the active part of the line
+static void build_vactive_line_cmds(const hstx_dvi_mode_t* mode, uint32_t* l) {
+    build_vactive_line(mode, l);
+    l[count_of(vactive_line) - 1] = HSTX_CMD_NOP;
+}
 
-static uint32_t vactive_line[] = {
-    HSTX_CMD_RAW_REPEAT | MODE_H_FRONT_PORCH,
-    SYNC_V1_H1,
-    HSTX_CMD_NOP,
-    HSTX_CMD_RAW_REPEAT | MODE_H_SYNC_WIDTH,
-    SYNC_V1_H0,
-    HSTX_CMD_NOP,
-    HSTX_CMD_RAW_REPEAT | MODE_H_BACK_PORCH,
-    SYNC_V1_H1,
-    HSTX_CMD_TMDS       | MODE_H_ACTIVE_PIXELS
+// ----------------------------------------------------------------------------
+// Pixel formats
+//
+// Each format is a TMDS expander setup. The expand_shift and expand_tmds
+// values for each are worked out at init and kept together, in register
+// order, so they can be written from the IRQ or DMAed straight into the
+// HSTX in ring mode.
+
+typedef struct {
+    uint8_t bits;
+    uint8_t nbits[3];   // Bits - 1 in lanes 2 (red), 1 (green) and 0 (blue)
+    uint8_t rot[3];     // Right rotation to bring each field to the top of the low byte
+} pixel_format_t;
+
+static const pixel_format_t _pixel_formats[HSTX_DVI_FORMAT_COUNT] = {
+    [HSTX_DVI_FORMAT_MONO1]  = {1,  {0, 0, 0}, {25, 25, 25}},  // The same bit to all lanes
+    [HSTX_DVI_FORMAT_GREY2]  = {2,  {1, 1, 1}, {26, 26, 26}},  // The same 2 bits to all lanes
+    [HSTX_DVI_FORMAT_RGB121] = {4,  {0, 1, 0}, {28, 27, 25}},
+    [HSTX_DVI_FORMAT_RGB332] = {8,  {2, 2, 1}, {0,  29, 26}},
+    [HSTX_DVI_FORMAT_RGB565] = {16, {4, 5, 4}, {8,  3,  29}},
 };
 
+#if MODE_BITS_PER_PIXEL == 1
+#define MODE_PIXEL_FORMAT HSTX_DVI_FORMAT_MONO1
+#elif MODE_BITS_PER_PIXEL == 2
+#define MODE_PIXEL_FORMAT HSTX_DVI_FORMAT_GREY2
+#elif MODE_BITS_PER_PIXEL == 4
+#define MODE_PIXEL_FORMAT HSTX_DVI_FORMAT_RGB121
+#elif MODE_BITS_PER_PIXEL == 8
+#define MODE_PIXEL_FORMAT HSTX_DVI_FORMAT_RGB332
+#elif MODE_BITS_PER_PIXEL == 16
+#define MODE_PIXEL_FORMAT HSTX_DVI_FORMAT_RGB565
+#else
+    #error "Unsupported MODE_BITS_PER_PIXEL value"
+#endif
+
+#define FORMAT_NONE 0xff
+
+// expand_shift then expand_tmds for each format
+static uint32_t __aligned(8) _format_regs[HSTX_DVI_FORMAT_COUNT][2];
+// The format the HSTX is set up for. In ring mode this runs ahead with the
+// blocks being filled.
+static uint32_t _format = HSTX_DVI_FORMAT_DEFAULT;
+
+static void build_format_regs(const uint32_t h_repeat) {
+    for (uint32_t f = 0; f < HSTX_DVI_FORMAT_COUNT; ++f) {
+        const pixel_format_t* p = &_pixel_formats[f ? f : MODE_PIXEL_FORMAT];
+        // Pixels (TMDS) come in 32/bits chunks (0 means 32). Repeated pixels
+        // arrive as narrow writes, which the bus replicates across the word,
+        // so shift out h_repeat copies. Control symbols (RAW) are an entire
+        // 32-bit word.
+        const uint32_t enc_n_shifts = !f && h_repeat > 1 ? h_repeat : (32 / p->bits) & 0x1f;
+        _format_regs[f][0] =
+            enc_n_shifts << HSTX_CTRL_EXPAND_SHIFT_ENC_N_SHIFTS_LSB |
+            p->bits << HSTX_CTRL_EXPAND_SHIFT_ENC_SHIFT_LSB |
+            1 << HSTX_CTRL_EXPAND_SHIFT_RAW_N_SHIFTS_LSB |
+            0 << HSTX_CTRL_EXPAND_SHIFT_RAW_SHIFT_LSB;
+        _format_regs[f][1] =
+            p->nbits[0] << HSTX_CTRL_EXPAND_TMDS_L2_NBITS_LSB |
+            p->rot[0]   << HSTX_CTRL_EXPAND_TMDS_L2_ROT_LSB   |
+            p->nbits[1] << HSTX_CTRL_EXPAND_TMDS_L1_NBITS_LSB |
+            p->rot[1]   << HSTX_CTRL_EXPAND_TMDS_L1_ROT_LSB   |
+            p->nbits[2] << HSTX_CTRL_EXPAND_TMDS_L0_NBITS_LSB |
+            p->rot[2]   << HSTX_CTRL_EXPAND_TMDS_L0_ROT_LSB;
+    }
+}
+
+static __force_inline void set_format(const uint32_t format) {
+    hstx_ctrl_hw->expand_shift = _format_regs[format][0];
+    hstx_ctrl_hw->expand_tmds = _format_regs[format][1];
+    _format = format;
+}
+
+uint32_t hstx_dvi_format_bits(const hstx_dvi_format_t format) {
+    return format ? _pixel_formats[format].bits : MODE_BITS_PER_PIXEL;
+}
+
+// ----------------------------------------------------------------------------
+// Per-scanline dispatch
+
+#ifndef HSTX_DVI_MAX_V_TOTAL_LINES
+#define HSTX_DVI_MAX_V_TOTAL_LINES 1125
+#endif
+
+typedef enum {
+    LINE_VBLANK_VSYNC_OFF = 0,
+    LINE_VBLANK_VSYNC_ON,
+    LINE_VACTIVE
+} line_type_t;
+
+static uint8_t _line_type[HSTX_DVI_MAX_V_TOTAL_LINES];
+static uint32_t _v_total_lines;
+static uint32_t _v_active_first;
+static uint32_t _row_words;
+static const hstx_dvi_mode_t* _mode;
+
+static void build_line_types(const hstx_dvi_mode_t* mode) {
+    const uint32_t sync_first = mode->v_front_porch;
+    const uint32_t sync_last = sync_first + mode->v_sync_width;
+    _v_active_first = sync_last + mode->v_back_porch;
+    _v_total_lines = hstx_dvi_mode_v_total(mode);
+    for (uint32_t i = 0; i < _v_total_lines; ++i) {
+        if (i >= _v_active_first) {
+            _line_type[i] = LINE_VACTIVE;
+        }
+        else if (i >= sync_first && i < sync_last) {
+            _line_type[i] = LINE_VBLANK_VSYNC_ON;
+        }
+        else {
+            _line_type[i] = LINE_VBLANK_VSYNC_OFF;
+        }
+    }
+}
+
 // ----------------------------------------------------------------------------
 // DMA logic
 
@@ -111,7 +225,364 @@ static  bool vactive_cmdlist_posted = false;
 
 static hstx_dvi_pixel_row_fetcher _row_fetcher;
 static hstx_dvi_row_t _underflow_row;
-static uint32_t _skipline = MODE_V_ACTIVE_LINES;
+static uint32_t _skipline = 0;
+static hstx_dvi_underflow_policy_t _underflow_policy = HSTX_DVI_UNDERFLOW_DROP_FRAME;
+static hstx_dvi_pixel_t _underflow_colour = 0;
+static bool _underflow_colour_set = false;
+// Rows owed by the producer for lines that have already been shown
+static uint32_t _row_debt = 0;
+// The fetcher hands out rows by line, and does its own catching up
+static bool _row_fetcher_tagged = false;
+static hstx_dvi_row_release_callback _row_release = 0;
+// The last fetched row, after another replaces it. It is released once the
+// DMA has finished with it.
+static hstx_dvi_row_t* _retired_row = 0;
+
+// For measuring the IRQ rate
+static volatile uint32_t _irq_count = 0;
+static volatile uint32_t _frame_count = 0;
+
+// ----------------------------------------------------------------------------
+// Statistics
+
+#if HSTX_DVI_STATS
+
+// Accumulated over the current frame
+static hstx_dvi_stats_t _stats_frame;
+// The last complete frame, guarded by a sequence count which is odd while
+// it is being written
+static hstx_dvi_stats_t _stats;
+static volatile uint32_t _stats_seq = 0;
+static hstx_dvi_queue_level_probe _queue_level_probe = 0;
+
+static void stats_reset_frame() {
+    const uint32_t total_underflows = _stats_frame.total_underflows;
+    const uint32_t frames_with_underflow = _stats_frame.frames_with_underflow;
+    memset(&_stats_frame, 0, sizeof(_stats_frame));
+    _stats_frame.frame = _frame_count;
+    _stats_frame.first_missed_line = HSTX_DVI_STATS_NONE;
+    _stats_frame.queue_level_min = HSTX_DVI_STATS_NONE;
+    _stats_frame.total_underflows = total_underflows;
+    _stats_frame.frames_with_underflow = frames_with_underflow;
+}
+
+static void HSTX_DVI_MEM_LOC(stats_publish)() {
+    if (_stats_frame.underflows) {
+        ++_stats_frame.frames_with_underflow;
+    }
+    ++_stats_seq;
+    __dmb();
+    _stats = _stats_frame;
+    __dmb();
+    ++_stats_seq;
+    stats_reset_frame();
+}
+
+static __force_inline uint32_t stats_cycles() {
+    return systick_hw->cvr;
+}
+
+static __force_inline void stats_fetch(const uint32_t start, const uint32_t level) {
+    // SysTick counts down
+    const uint32_t cycles = (start - stats_cycles()) & 0x00ffffff;
+    _stats_frame.fetches++;
+    _stats_frame.fetch_cycles_total += cycles;
+    if (cycles > _stats_frame.fetch_cycles_max) _stats_frame.fetch_cycles_max = cycles;
+    if (level < _stats_frame.queue_level_min) _stats_frame.queue_level_min = level;
+    _stats_frame.queue_level_hist[level < HSTX_DVI_STATS_LEVEL_BUCKETS ? level : HSTX_DVI_STATS_LEVEL_BUCKETS - 1]++;
+}
+
+static __force_inline void stats_underflow(const uint32_t line) {
+    if (_stats_frame.first_missed_line == HSTX_DVI_STATS_NONE) _stats_frame.first_missed_line = line;
+    _stats_frame.underflows++;
+    _stats_frame.total_underflows++;
+}
+
+static __force_inline void stats_irq_latency(const uint32_t words) {
+    const uint32_t b = words ? 32 - __builtin_clz(words) : 0;
+    _stats_frame.irq_latency_hist[b < HSTX_DVI_STATS_LATENCY_BUCKETS ? b : HSTX_DVI_STATS_LATENCY_BUCKETS - 1]++;
+}
+
+static void stats_init() {
+    // SysTick free runs on the processor clock
+    systick_hw->rvr = 0x00ffffff;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5;
+    stats_reset_frame();
+}
+
+bool hstx_dvi_stats_get(hstx_dvi_stats_t* stats) {
+    uint32_t seq;
+    do {
+        seq = _stats_seq;
+        __dmb();
+        *stats = _stats;
+        __dmb();
+    } while ((seq & 1) || seq != _stats_seq);
+    return true;
+}
+
+void hstx_dvi_stats_set_queue_level_probe(hstx_dvi_queue_level_probe probe) {
+    _queue_level_probe = probe;
+}
+
+#else
+
+bool hstx_dvi_stats_get(hstx_dvi_stats_t* stats) {
+    (void)stats;
+    return false;
+}
+
+void hstx_dvi_stats_set_queue_level_probe(hstx_dvi_queue_level_probe probe) {
+    (void)probe;
+}
+
+#endif
+
+// Pixel and line repeat. Each row is shown _v_repeat times and each pixel
+// in it _h_repeat times.
+static uint32_t _h_repeat = 1;
+static uint32_t _v_repeat = 1;
+static uint32_t _v_repeat_left = 0;
+static uint32_t _row_index = 0;
+static const hstx_dvi_row_t* _row = 0;
+static const hstx_dvi_row_t* _last_row = 0;
+
+// What to post for the active part of the current line. The row is fetched
+// when the line's command list is posted, so the right list can be picked
+// for it.
+static const uint32_t* _post_w;
+static uint32_t _post_words;
+static bool _post_cmds;
+static uint32_t _post_format;
+
+static __force_inline void post_underflow_row() {
+#if HSTX_DVI_STATS
+    _stats_frame.dropped_lines++;
+#endif
+    _post_w = _underflow_row.w;
+    _post_words = _row_words;
+    _post_cmds = false;
+    _post_format = HSTX_DVI_FORMAT_DEFAULT;
+}
+
+void HSTX_DVI_MEM_LOC(hstx_dvi_release_row)(hstx_dvi_row_t* row) {
+    if (_row_release && row) _row_release(row);
+}
+
+static __force_inline void retire_row(const hstx_dvi_row_t* row) {
+    if (row) _retired_row = (hstx_dvi_row_t*)row;
+}
+
+static __force_inline const hstx_dvi_row_t* call_row_fetcher(const uint32_t row_index) {
+#if HSTX_DVI_STATS
+    const uint32_t level = _queue_level_probe ? _queue_level_probe() : 0;
+    const uint32_t start = stats_cycles();
+    const hstx_dvi_row_t* row = _row_fetcher(row_index);
+    stats_fetch(start, level);
+    return row;
+#else
+    return _row_fetcher(row_index);
+#endif
+}
+
+static __force_inline void fetch_row() {
+    if (_skipline) {
+        --_skipline;
+        post_underflow_row();
+        return;
+    }
+    if (v_scanline == _v_active_first) {
+        _v_repeat_left = 0;
+        _row_index = 0;
+        // Rows missed last frame are not owed by this one
+        _row_debt = 0;
+        retire_row(_last_row);
+        _last_row = 0;
+    }
+    if (!_v_repeat_left) {
+        // Only fetch on the first of a group of repeated lines
+        _row = call_row_fetcher(_row_index);
+        // Catch up by throwing away rows that were meant for lines already shown
+        while (_row && _row_debt) {
+            --_row_debt;
+            hstx_dvi_release_row((hstx_dvi_row_t*)_row);
+            _row = call_row_fetcher(_row_index);
+        }
+        ++_row_index;
+        _v_repeat_left = _v_repeat;
+        if (_row) {
+            if (_last_row != _row) retire_row(_last_row);
+            _last_row = _row;
+        }
+        else {
+#if HSTX_DVI_STATS
+            stats_underflow(v_scanline - _v_active_first);
+#endif
+            switch (_underflow_policy) {
+                case HSTX_DVI_UNDERFLOW_REPEAT_ROW:
+                    _row = _last_row;
+                    break;
+                case HSTX_DVI_UNDERFLOW_RESYNC:
+                    // A tagged fetcher has nothing more for this line, so
+                    // throwing its next row away would lose the next line
+                    if (!_row_fetcher_tagged && _row_debt < _mode->v_active_lines) ++_row_debt;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    --_v_repeat_left;
+    if (!_row) {
+        // If we miss a line drop the rest of the frame. The active lines
+        // are the last in it.
+        if (_underflow_policy == HSTX_DVI_UNDERFLOW_DROP_FRAME) {
+            _skipline = _v_total_lines - 1 - v_scanline;
+        }
+        post_underflow_row();
+    }
+    else if (hstx_dvi_row_is_desc(_row)) {
+        const hstx_dvi_row_desc_t* d = hstx_dvi_row_get_desc(_row);
+        _post_w = d->w;
+        _post_words = d->words;
+        _post_cmds = d->kind == HSTX_DVI_ROW_KIND_CMDS;
+        // Command lists produce every pixel of the line themselves, so they
+        // must not go through the default format's pixel repeat. The build's
+        // own format is the same encoding without it.
+        _post_format = _post_cmds && d->format == HSTX_DVI_FORMAT_DEFAULT && _h_repeat > 1
+            ? MODE_PIXEL_FORMAT
+            : d->format;
+    }
+    else {
+        _post_w = _row->w;
+        _post_words = _row_words;
+        _post_cmds = false;
+        _post_format = HSTX_DVI_FORMAT_DEFAULT;
+    }
+}
+
+// Work out the next thing to DMA to the HSTX and advance the scan position.
+// Sets the words and word count, and whether it is a pixel row in the
+// default format (which may need a narrow transfer). Rows in other formats
+// are whole words.
+static __force_inline void next_transfer(const uint32_t** w, uint32_t* count, bool* row) {
+    *row = false;
+    switch (_line_type[v_scanline]) {
+        case LINE_VBLANK_VSYNC_ON:
+            *w = vblank_line_vsync_on;
+            *count = count_of(vblank_line_vsync_on);
+            break;
+        case LINE_VBLANK_VSYNC_OFF:
+            *w = vblank_line_vsync_off;
+            *count = count_of(vblank_line_vsync_off);
+            break;
+        default:
+            if (!vactive_cmdlist_posted) {
+                fetch_row();
+                if (_post_cmds) {
+                    *w = vactive_line_cmds;
+                    *count = count_of(vactive_line_cmds);
+                }
+                else {
+                    *w = vactive_line;
+                    *count = count_of(vactive_line);
+                }
+                vactive_cmdlist_posted = true;
+            } else {
+                *w = _post_w;
+                *count = _post_words;
+                *row = !_post_cmds && _post_format == HSTX_DVI_FORMAT_DEFAULT;
+                vactive_cmdlist_posted = false;
+            }
+            break;
+    }
+
+    if (!vactive_cmdlist_posted) {
+        if (++v_scanline == _v_total_lines) {
+            v_scanline = 0;
+            ++_frame_count;
+#if HSTX_DVI_STATS
+            stats_publish();
+#endif
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Beam events
+//
+// Transfers are posted ahead of the beam, by a line in ping/pong mode and by
+// up to a ring in ring mode, so events are raised from the line of the
+// transfer the DMA is working on rather than from v_scanline.
+
+static volatile uint32_t _vblank_frame = 0;
+static hstx_dvi_scanline_callback _vblank_callback = 0;
+static bool _vblank_sev = false;
+static hstx_dvi_scanline_callback _scanline_callback = 0;
+static bool _scanline_sev = false;
+// The scanline event line, counted from the first vblank line like
+// v_scanline. Line 0 is the start of vblank.
+static uint32_t _event_line = HSTX_DVI_SCANLINE_NONE;
+static uint32_t _beam_line_last = HSTX_DVI_SCANLINE_NONE;
+
+// Lines as seen by applications, with the active area first
+static __force_inline uint32_t public_line(const uint32_t line) {
+    return line >= _v_active_first ? line - _v_active_first : line + _mode->v_active_lines;
+}
+
+static __force_inline bool is_event_line(const uint32_t line) {
+    return line == 0 || line == _event_line;
+}
+
+// How many lines on from one line another is, going round the frame
+static __force_inline uint32_t lines_after(const uint32_t from, const uint32_t line) {
+    return line >= from ? line - from : line + _v_total_lines - from;
+}
+
+static __force_inline void vblank_event() {
+    const uint32_t frame = ++_vblank_frame;
+    if (_vblank_sev) __sev();
+    if (_vblank_callback) _vblank_callback(frame, _mode->v_active_lines);
+}
+
+static __force_inline void scanline_event() {
+    if (_scanline_sev) __sev();
+    if (_scanline_callback) _scanline_callback(_vblank_frame, public_line(_event_line));
+}
+
+// The beam is on a line. An IRQ that is late may already be some lines past
+// an event's line, so events fire as the beam passes their line rather than
+// only when it is seen on it.
+static __force_inline void beam_event(const uint32_t line) {
+    const uint32_t last = _beam_line_last;
+    if (line == last) return;
+    _beam_line_last = line;
+    const uint32_t ahead = lines_after(last, line);
+    const uint32_t to_vblank = lines_after(last, 0);
+    const uint32_t to_event = lines_after(last, _event_line);
+    const bool vblank = to_vblank && to_vblank <= ahead;
+    const bool event = _event_line != HSTX_DVI_SCANLINE_NONE && to_event && to_event <= ahead;
+    if (event && to_event < to_vblank) scanline_event();
+    if (vblank) vblank_event();
+    if (event && to_event >= to_vblank) scanline_event();
+}
+
+// ----------------------------------------------------------------------------
+// Ping/pong IRQ mode
+
+// Channel control words for command lists (32-bit transfers) and for pixel
+// rows, which are narrow transfers when pixels are repeated horizontally.
+static uint32_t _dma_ctrl_cmd[2];
+static uint32_t _dma_ctrl_row[2];
+// The scanline each channel was last loaded with
+static uint16_t _posted_line[2] = {0, 1};
+// The format of the row after the command list each channel was loaded
+// with, FORMAT_NONE if it was loaded with something else
+static uint8_t _dma_format[2] = {FORMAT_NONE, FORMAT_NONE};
+#if HSTX_DVI_STATS
+static uint32_t _dma_count[2];
+#endif
 
 static void HSTX_DVI_MEM_LOC(dma_irq_handler)() {
 
@@ -121,99 +592,443 @@ static void HSTX_DVI_MEM_LOC(dma_irq_handler)() {
     dma_channel_hw_t *ch = &dma_hw->ch[ch_num];
     dma_hw->intr = 1u << ch_num;
     dma_pong = !dma_pong;
+    ++_irq_count;
+
+    // A row is retired as the command list for the line after it is posted,
+    // while the other channel transfers it. That is the channel that just
+    // finished.
+    if (_retired_row) {
+        hstx_dvi_release_row(_retired_row);
+        _retired_row = 0;
+    }
+
+    // A command list just went into the FIFO, so the last row has been
+    // shifted out and the next one is a porch and sync away. A DMA write
+    // to the expander here would race the other channel, which is already
+    // running, so switch format from the IRQ.
+    const uint32_t format = _dma_format[ch_num];
+    if (format != FORMAT_NONE && format != _format) {
+        set_format(format);
+    }
+
+    // The other channel is already on its way
+    const uint other = dma_pong ? DMACH_PONG : DMACH_PING;
+    beam_event(_posted_line[other]);
 
-    if (v_scanline >= MODE_V_FRONT_PORCH && v_scanline < (MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH)) {
-        ch->read_addr = (uintptr_t)vblank_line_vsync_on;
-        ch->transfer_count = count_of(vblank_line_vsync_on);
-    } else if (v_scanline < MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH + MODE_V_BACK_PORCH) {
-        ch->read_addr = (uintptr_t)vblank_line_vsync_off;
-        ch->transfer_count = count_of(vblank_line_vsync_off);
-    } else if (!vactive_cmdlist_posted) {
-        ch->read_addr = (uintptr_t)vactive_line;
-        ch->transfer_count = count_of(vactive_line);
-        vactive_cmdlist_posted = true;
-    } else {
-        if (_skipline) {
-            ch->read_addr = (uintptr_t)&_underflow_row; 
-            --_skipline;
+#if HSTX_DVI_STATS
+    // How far the other channel has got since this one finished
+    stats_irq_latency(_dma_count[other] - (dma_hw->ch[other].transfer_count & 0x0fffffff));
+#endif
+
+    const uint32_t* w;
+    uint32_t count;
+    bool row;
+    _posted_line[ch_num] = v_scanline;
+    next_transfer(&w, &count, &row);
+    _dma_format[ch_num] = vactive_cmdlist_posted ? _post_format : FORMAT_NONE;
+    ch->read_addr = (uintptr_t)w;
+    ch->transfer_count = count;
+    ch->al1_ctrl = row ? _dma_ctrl_row[ch_num] : _dma_ctrl_cmd[ch_num];
+#if HSTX_DVI_STATS
+    _dma_count[ch_num] = count;
+#endif
+}
+
+// The first two lines are posted at init, before the IRQ takes over. They
+// are always vblank but may already be in vsync.
+static const uint32_t* init_vblank_line(const uint32_t line) {
+    return _line_type[line] == LINE_VBLANK_VSYNC_ON ? vblank_line_vsync_on : vblank_line_vsync_off;
+}
+
+static void init_ping_pong_dma() {
+    // Both channels are set up identically, to transfer a whole scanline and
+    // then chain to the opposite channel. Each time a channel finishes, we
+    // reconfigure the one that just finished, meanwhile the opposite channel
+    // is already making progress.
+    dma_channel_config c;
+    c = dma_channel_get_default_config(DMACH_PING);
+    channel_config_set_chain_to(&c, DMACH_PONG);
+    channel_config_set_dreq(&c, DREQ_HSTX);
+    dma_channel_configure(
+        DMACH_PING,
+        &c,
+        &hstx_fifo_hw->fifo,
+        init_vblank_line(0),
+        count_of(vblank_line_vsync_off),
+        false
+    );
+    c = dma_channel_get_default_config(DMACH_PONG);
+    channel_config_set_chain_to(&c, DMACH_PING);
+    channel_config_set_dreq(&c, DREQ_HSTX);
+    dma_channel_configure(
+        DMACH_PONG,
+        &c,
+        &hstx_fifo_hw->fifo,
+        init_vblank_line(1),
+        count_of(vblank_line_vsync_off),
+        false
+    );
+
+    // Keep the control words so the IRQ can switch transfer size between
+    // command lists and rows
+    for (uint i = 0; i < 2; ++i) {
+        const uint ch_num = i ? DMACH_PONG : DMACH_PING;
+        c = dma_channel_get_default_config(ch_num);
+        channel_config_set_chain_to(&c, i ? DMACH_PING : DMACH_PONG);
+        channel_config_set_dreq(&c, DREQ_HSTX);
+        _dma_ctrl_cmd[ch_num] = channel_config_get_ctrl_value(&c);
+        if (_h_repeat > 1) {
+            channel_config_set_transfer_data_size(&c, MODE_BITS_PER_PIXEL == 8 ? DMA_SIZE_8 : DMA_SIZE_16);
+        }
+        _dma_ctrl_row[ch_num] = channel_config_get_ctrl_value(&c);
+    }
+
+    dma_hw->ints0 = (1u << DMACH_PING) | (1u << DMACH_PONG);
+    dma_hw->inte0 = (1u << DMACH_PING) | (1u << DMACH_PONG);
+    irq_set_exclusive_handler(DMA_IRQ_0, dma_irq_handler);
+    irq_set_enabled(DMA_IRQ_0, true);
+}
+
+
+// ----------------------------------------------------------------------------
+// Control block ring mode
+//
+// A third channel loads the data channel from a ring of control blocks, each
+// of which is a complete transfer (command list or row). The data channel
+// chains back to the ring channel when it finishes, so no IRQ is needed per
+// transfer. Only the last block of each half of the ring raises an IRQ, and
+// the handler refills that half. The ring is followed by one block that DMAs
+// the ring's address back into the ring channel's read address. The block
+// before the start of vblank, and of the scanline event line, also raises an
+// IRQ so beam events land on time.
+//
+// A single data channel is enough here: the HSTX FIFO covers the couple of
+// cycles it takes the ring channel to load the next block.
+//
+// A row in a different pixel format gets an extra block after its command
+// list that DMAs the format's expander setup into the HSTX, in the porch
+// and sync before the row's pixels.
+
+#define DMACH_RING 2
+
+#ifndef HSTX_DVI_DMA_RING_MAX_BLOCKS
+#define HSTX_DVI_DMA_RING_MAX_BLOCKS 64
+#endif
+
+// Laid out as the data channel's alias 0 registers. Addresses are pointer
+// sized, which is 32 bits on the Pico, so the host emulator can follow the
+// ring too.
+typedef struct {
+    uintptr_t read_addr;
+    uintptr_t write_addr;
+    uint32_t transfer_count;
+    uint32_t ctrl_trig;
+} dma_ctrl_block_t;
+
+static dma_ctrl_block_t __aligned(16) _ring[HSTX_DVI_DMA_RING_MAX_BLOCKS + 1];
+static uintptr_t _ring_base;
+static uint32_t _ring_blocks = 0;
+static uint32_t _ring_fill = 0;
+static uint32_t _ring_ctrl_cmd;
+static uint32_t _ring_ctrl_row;
+static uint32_t _ring_ctrl_format;
+static bool _ring_format_pending = false;
+// The scanline of each block
+static uint16_t _ring_line[HSTX_DVI_DMA_RING_MAX_BLOCKS];
+// Rows retired as each block was filled, released when it is next filled
+static hstx_dvi_row_t* _ring_release[HSTX_DVI_DMA_RING_MAX_BLOCKS];
+
+static void HSTX_DVI_MEM_LOC(fill_ring)(const uint32_t n) {
+    const uint32_t half = _ring_blocks >> 1;
+    for (uint32_t i = 0; i < n; ++i) {
+        dma_ctrl_block_t *b = &_ring[_ring_fill];
+        const uint32_t line = v_scanline;
+        if (!vactive_cmdlist_posted && is_event_line(line)) {
+            // Interrupt as the previous line finishes. Either it is in the
+            // half being filled, or it ends the other half and interrupts
+            // anyway.
+            _ring[_ring_fill ? _ring_fill - 1 : _ring_blocks - 1].ctrl_trig &= ~DMA_CH0_CTRL_TRIG_IRQ_QUIET_BITS;
+        }
+        _ring_line[_ring_fill] = line;
+        // The block, and the ones before it, are done with
+        hstx_dvi_release_row(_ring_release[_ring_fill]);
+        const uint32_t* w;
+        uint32_t count;
+        uint32_t ctrl;
+        uintptr_t write_addr = (uintptr_t)&hstx_fifo_hw->fifo;
+        if (_ring_format_pending) {
+            // Switch format now the row's command list is in the FIFO
+            _ring_format_pending = false;
+            _format = _post_format;
+            w = _format_regs[_format];
+            count = 2;
+            ctrl = _ring_ctrl_format;
+            write_addr = (uintptr_t)&hstx_ctrl_hw->expand_shift;
         }
         else {
-            const hstx_dvi_row_t* row = _row_fetcher(v_scanline - (MODE_V_FRONT_PORCH + MODE_V_SYNC_WIDTH + MODE_V_BACK_PORCH));
-            if (row) {
-                ch->read_addr = (uintptr_t)&row->w; 
-            }
-            else {
-                // If we miss a line drop a whole frame
-                _skipline = MODE_V_ACTIVE_LINES - 1;
-                ch->read_addr = (uintptr_t)&_underflow_row; 
-            }
+            bool row;
+            next_transfer(&w, &count, &row);
+            ctrl = row ? _ring_ctrl_row : _ring_ctrl_cmd;
+            _ring_format_pending = vactive_cmdlist_posted && _post_format != _format;
         }
-        ch->transfer_count = (MODE_BYTES_PER_PIXEL * MODE_H_ACTIVE_PIXELS) / sizeof(uint32_t);
-        vactive_cmdlist_posted = false;
+        _ring_release[_ring_fill] = _retired_row;
+        _retired_row = 0;
+        if (++_ring_fill == _ring_blocks) _ring_fill = 0;
+        // Only interrupt at the end of each half
+        if (_ring_fill != 0 && _ring_fill != half) {
+            ctrl |= DMA_CH0_CTRL_TRIG_IRQ_QUIET_BITS;
+        }
+        b->read_addr = (uintptr_t)w;
+        b->write_addr = write_addr;
+        b->transfer_count = count;
+        b->ctrl_trig = ctrl;
+    }
+}
+
+// The block the data channel is working on
+static __force_inline uint32_t ring_block() {
+    // The ring channel's read address is just past the last block it loaded
+    const uint32_t i = (dma_hw->ch[DMACH_RING].read_addr - _ring_base) / sizeof(dma_ctrl_block_t);
+    // 0 is about to load the first block, past the end is the jump block
+    return i && i <= _ring_blocks ? i - 1 : 0;
+}
+
+static void HSTX_DVI_MEM_LOC(dma_ring_irq_handler)() {
+    dma_hw->intr = 1u << DMACH_PING;
+    ++_irq_count;
+    const uint32_t half = _ring_blocks >> 1;
+    const uint32_t block = ring_block();
+    beam_event(_ring_line[block]);
+    // Refill the half that just finished, if the data channel has left it
+    if ((block < half) == (_ring_fill != 0)) {
+#if HSTX_DVI_STATS
+        // How far the data channel has got with the first block of the other half
+        const uint32_t next = _ring_fill ? 0 : half;
+        stats_irq_latency(_ring[next].transfer_count - (dma_hw->ch[DMACH_PING].transfer_count & 0x0fffffff));
+#endif
+        fill_ring(half);
     }
+}
 
-    if (!vactive_cmdlist_posted) {
-        v_scanline = (v_scanline + 1) % MODE_V_TOTAL_LINES;
+static void init_ring_dma() {
+    dma_channel_config c;
+
+    c = dma_channel_get_default_config(DMACH_PING);
+    channel_config_set_chain_to(&c, DMACH_RING);
+    channel_config_set_dreq(&c, DREQ_HSTX);
+    _ring_ctrl_cmd = channel_config_get_ctrl_value(&c);
+    if (_h_repeat > 1) {
+        channel_config_set_transfer_data_size(&c, MODE_BITS_PER_PIXEL == 8 ? DMA_SIZE_8 : DMA_SIZE_16);
+    }
+    _ring_ctrl_row = channel_config_get_ctrl_value(&c);
+
+    // Format switches write both expander registers as fast as they can
+    c = dma_channel_get_default_config(DMACH_PING);
+    channel_config_set_chain_to(&c, DMACH_RING);
+    channel_config_set_write_increment(&c, true);
+    _ring_ctrl_format = channel_config_get_ctrl_value(&c);
+
+    // The last block sends the ring channel back to the start
+    _ring_base = (uintptr_t)_ring;
+    c = dma_channel_get_default_config(DMACH_PING);
+    channel_config_set_chain_to(&c, DMACH_RING);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_irq_quiet(&c, true);
+    dma_ctrl_block_t *jump = &_ring[_ring_blocks];
+    jump->read_addr = (uintptr_t)&_ring_base;
+    jump->write_addr = (uintptr_t)&dma_hw->ch[DMACH_RING].read_addr;
+    jump->transfer_count = 1;
+    jump->ctrl_trig = channel_config_get_ctrl_value(&c);
+
+    // Nothing is queued up ahead in this mode
+    v_scanline = 0;
+    _ring_fill = 0;
+    _ring_format_pending = false;
+    fill_ring(_ring_blocks);
+
+    // The ring channel writes a whole block to the data channel each time it
+    // is triggered, wrapping its write address back to the data channel's
+    // first register
+    c = dma_channel_get_default_config(DMACH_RING);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, 4);
+    dma_channel_configure(
+        DMACH_RING,
+        &c,
+        &dma_hw->ch[DMACH_PING].read_addr,
+        _ring,
+        sizeof(dma_ctrl_block_t) / sizeof(uint32_t),
+        false
+    );
+
+    dma_hw->ints0 = 1u << DMACH_PING;
+    dma_hw->inte0 = 1u << DMACH_PING;
+    irq_set_exclusive_handler(DMA_IRQ_0, dma_ring_irq_handler);
+    irq_set_enabled(DMA_IRQ_0, true);
+}
+
+void hstx_dvi_set_dma_ring(const uint32_t blocks) {
+    _ring_blocks = blocks;
+}
+
+uint32_t hstx_dvi_get_dma_ring() {
+    return _ring_blocks;
+}
+
+uint32_t hstx_dvi_get_irq_count() {
+    return _irq_count;
+}
+
+uint32_t hstx_dvi_get_frame_count() {
+    return _vblank_frame;
+}
+
+uint32_t hstx_dvi_get_fetch_frame() {
+    // Counted as the last line is posted, rather than when vblank starts, and
+    // from 0 where the vblank count already has the first frame
+    return _frame_count + 1;
+}
+
+uint32_t hstx_dvi_get_scanline() {
+    uint32_t line;
+    if (_ring_blocks) {
+        line = _ring_line[ring_block()];
+    }
+    else {
+        line = _posted_line[dma_channel_is_busy(DMACH_PING) ? DMACH_PING : DMACH_PONG];
     }
+    return public_line(line);
+}
+
+void hstx_dvi_set_vblank_callback(hstx_dvi_scanline_callback callback, const bool sev) {
+    _vblank_callback = callback;
+    _vblank_sev = sev;
+}
+
+void hstx_dvi_set_scanline_callback(const uint32_t scanline, hstx_dvi_scanline_callback callback, const bool sev) {
+    _scanline_callback = callback;
+    _scanline_sev = sev;
+    _event_line = scanline;
+}
+
+uint32_t hstx_dvi_wait_for_vblank() {
+    const uint32_t frame = _vblank_frame;
+    while (frame == _vblank_frame) {
+        if (_vblank_sev) __wfe(); else tight_loop_contents();
+    }
+    return _vblank_frame;
 }
 
 void hstx_dvi_init(hstx_dvi_pixel_row_fetcher row_fetcher) {
+    hstx_dvi_init_mode(&hstx_dvi_mode_640x480_60, row_fetcher);
+}
+
+const hstx_dvi_mode_t* hstx_dvi_get_mode() {
+    return _mode;
+}
 
+uint32_t hstx_dvi_get_row_count() {
+    return _mode->v_active_lines / _v_repeat;
+}
+
+void hstx_dvi_set_repeat(const uint32_t h_repeat, const uint32_t v_repeat) {
+    _h_repeat = h_repeat;
+    _v_repeat = v_repeat;
+}
+
+void hstx_dvi_set_underflow_policy(const hstx_dvi_underflow_policy_t policy) {
+    _underflow_policy = policy;
+}
+
+void hstx_dvi_set_row_fetcher_tagged(const bool tagged) {
+    _row_fetcher_tagged = tagged;
+}
+
+void hstx_dvi_set_row_release_callback(hstx_dvi_row_release_callback callback) {
+    _row_release = callback;
+}
+
+void hstx_dvi_set_underflow_colour(const hstx_dvi_pixel_t colour) {
+    _underflow_colour = colour;
+    _underflow_colour_set = true;
+}
+
+void hstx_dvi_init_mode(const hstx_dvi_mode_t* mode, hstx_dvi_pixel_row_fetcher row_fetcher) {
+
+    const uint32_t err = hstx_dvi_mode_validate(mode);
+    if (err) {
+        panic("hstx_dvi: invalid video mode %s (0x%04x)", mode ? mode->name : "NULL", (uint)err);
+    }
+    if ((_h_repeat != 1 && _h_repeat != 2 && _h_repeat != 4) || !_v_repeat ||
+        (mode->h_active_pixels % _h_repeat) || (mode->v_active_lines % _v_repeat)) {
+        panic("hstx_dvi: bad repeat %ux%u for video mode %s", (uint)_h_repeat, (uint)_v_repeat, mode->name);
+    }
+    if (_h_repeat > 1 && MODE_BITS_PER_PIXEL < 8) {
+        // Narrow writes would repeat whole bytes of packed pixels
+        panic("hstx_dvi: no horizontal repeat with %u bits per pixel", (uint)MODE_BITS_PER_PIXEL);
+    }
+    if (_ring_blocks && ((_ring_blocks & 1) || _ring_blocks < 4 || _ring_blocks > HSTX_DVI_DMA_RING_MAX_BLOCKS)) {
+        panic("hstx_dvi: bad DMA ring size %u", (uint)_ring_blocks);
+    }
+    if (mode->h_active_pixels > MODE_H_ACTIVE_PIXELS * _h_repeat ||
+        hstx_dvi_mode_v_total(mode) > HSTX_DVI_MAX_V_TOTAL_LINES) {
+        panic("hstx_dvi: video mode %s does not fit the row buffer", mode->name);
+    }
+
+    _mode = mode;
     _row_fetcher = row_fetcher;
+    // Repeated pixels are transferred one at a time and the expander shifts
+    // each out h_repeat times, as it can't repeat the pixels of a packed
+    // word. That is no fewer transfers than a full width row at 16 bpp, and
+    // twice as many at 8 bpp.
+    _row_words = _h_repeat > 1
+        ? mode->h_active_pixels / _h_repeat
+        : (MODE_BITS_PER_PIXEL * (uint32_t)mode->h_active_pixels + 31) >> 5;
+    _skipline = mode->v_active_lines;
+
+    build_vblank_line(mode, vblank_line_vsync_off, false);
+    build_vblank_line(mode, vblank_line_vsync_on, true);
+    build_vactive_line(mode, vactive_line);
+    build_vactive_line_cmds(mode, vactive_line_cmds);
+    build_line_types(mode);
+    if (_event_line != HSTX_DVI_SCANLINE_NONE) {
+        if (_event_line >= _v_total_lines) {
+            panic("hstx_dvi: scanline event %u is off the end of video mode %s", (uint)_event_line, mode->name);
+        }
+        // To internal line numbering, vblank first
+        _event_line = _event_line < mode->v_active_lines
+            ? _event_line + _v_active_first
+            : _event_line - mode->v_active_lines;
+    }
+#if HSTX_DVI_STATS
+    stats_init();
+#endif
 
+    const hstx_dvi_pixel_t underflow_colour = _underflow_colour_set
+        ? _underflow_colour
+        : hstx_dvi_pixel_rgb(0,255,0);
     for (uint32_t j = 0; j < MODE_H_ACTIVE_PIXELS; ++j)
     {
-        hstx_dvi_row_set_pixel(&_underflow_row, j, hstx_dvi_pixel_rgb(0,255,0));
+        hstx_dvi_row_set_pixel(&_underflow_row, j, underflow_colour);
     }
 
-    // Set core voltage to 1.2V
-    vreg_set_voltage(VREG_VOLTAGE_1_20);
+    // Set core voltage, the faster modes need a little more
+    vreg_set_voltage(mode->sys_clock_khz > 300000 ? VREG_VOLTAGE_1_30 : VREG_VOLTAGE_1_20);
 
-    // Set the system clock to 252 MHz
-    set_sys_clock_khz(252000, true);
+    // Set the system clock to whatever the mode needs
+    set_sys_clock_khz(mode->sys_clock_khz, true);
 
     clock_configure_int_divider(
         clk_hstx,
         0,
         CLOCKS_CLK_HSTX_CTRL_AUXSRC_VALUE_CLK_SYS,
-        252000000,
-        2
+        mode->sys_clock_khz * 1000,
+        mode->hstx_clock_div
     );
-#if MODE_BYTES_PER_PIXEL == 1
-    // Configure HSTX's TMDS encoder for RGB332
-    hstx_ctrl_hw->expand_tmds =
-        2  << HSTX_CTRL_EXPAND_TMDS_L2_NBITS_LSB | // 3 bits R
-        0  << HSTX_CTRL_EXPAND_TMDS_L2_ROT_LSB   | // >> 0
-        2  << HSTX_CTRL_EXPAND_TMDS_L1_NBITS_LSB | // 3 bits G
-        29 << HSTX_CTRL_EXPAND_TMDS_L1_ROT_LSB   | // << 3
-        1  << HSTX_CTRL_EXPAND_TMDS_L0_NBITS_LSB | // 2 bits B
-        26 << HSTX_CTRL_EXPAND_TMDS_L0_ROT_LSB;    // << 6
-    // Pixels (TMDS) come in 4 8-bit chunks. Control symbols (RAW) are an
-    // entire 32-bit word.
-    hstx_ctrl_hw->expand_shift =
-        4 << HSTX_CTRL_EXPAND_SHIFT_ENC_N_SHIFTS_LSB |
-        8 << HSTX_CTRL_EXPAND_SHIFT_ENC_SHIFT_LSB |
-        1 << HSTX_CTRL_EXPAND_SHIFT_RAW_N_SHIFTS_LSB |
-        0 << HSTX_CTRL_EXPAND_SHIFT_RAW_SHIFT_LSB;
-#elif MODE_BYTES_PER_PIXEL == 2
-    // Configure HSTX's TMDS encoder for RGB565 
-    hstx_ctrl_hw->expand_tmds =
-        4  << HSTX_CTRL_EXPAND_TMDS_L2_NBITS_LSB | // 5 bits R
-        8  << HSTX_CTRL_EXPAND_TMDS_L2_ROT_LSB   | // >> 8
-        5  << HSTX_CTRL_EXPAND_TMDS_L1_NBITS_LSB | // 6 bits G
-        3  << HSTX_CTRL_EXPAND_TMDS_L1_ROT_LSB   | // >> 3
-        4  << HSTX_CTRL_EXPAND_TMDS_L0_NBITS_LSB | // 5 bits B
-        29 << HSTX_CTRL_EXPAND_TMDS_L0_ROT_LSB   ; // << 3
-    // Pixels (TMDS) come in 2 16-bit chunks. Control symbols (RAW) are an
-    // entire 32-bit word.
-    hstx_ctrl_hw->expand_shift =
-        2  << HSTX_CTRL_EXPAND_SHIFT_ENC_N_SHIFTS_LSB |
-        16 << HSTX_CTRL_EXPAND_SHIFT_ENC_SHIFT_LSB |
-        1  << HSTX_CTRL_EXPAND_SHIFT_RAW_N_SHIFTS_LSB |
-        0  << HSTX_CTRL_EXPAND_SHIFT_RAW_SHIFT_LSB; 
-#else
-    #error "Unsupported MODE_BYTES_PER_PIXEL value"
-#endif
+    // Configure HSTX's TMDS encoder for the build's pixel format
+    build_format_regs(_h_repeat);
+    set_format(HSTX_DVI_FORMAT_DEFAULT);
 
     // Serial output config: clock period of 5 cycles, pop from command
     // expander every 5 cycles, shift the output shiftreg by 2 every cycle.
@@ -255,59 +1070,40 @@ void hstx_dvi_init(hstx_dvi_pixel_row_fetcher row_fetcher) {
         gpio_set_function(i, 0); // HSTX
     }
 
-    // Both channels are set up identically, to transfer a whole scanline and
-    // then chain to the opposite channel. Each time a channel finishes, we
-    // reconfigure the one that just finished, meanwhile the opposite channel
-    // is already making progress.
-    dma_channel_config c;
-    c = dma_channel_get_default_config(DMACH_PING);
-    channel_config_set_chain_to(&c, DMACH_PONG);
-    channel_config_set_dreq(&c, DREQ_HSTX);
-    dma_channel_configure(
-        DMACH_PING,
-        &c,
-        &hstx_fifo_hw->fifo,
-        vblank_line_vsync_off,
-        count_of(vblank_line_vsync_off),
-        false
-    );
-    c = dma_channel_get_default_config(DMACH_PONG);
-    channel_config_set_chain_to(&c, DMACH_PING);
-    channel_config_set_dreq(&c, DREQ_HSTX);
-    dma_channel_configure(
-        DMACH_PONG,
-        &c,
-        &hstx_fifo_hw->fifo,
-        vblank_line_vsync_off,
-        count_of(vblank_line_vsync_off),
-        false
-    );
-
-    dma_hw->ints0 = (1u << DMACH_PING) | (1u << DMACH_PONG);
-    dma_hw->inte0 = (1u << DMACH_PING) | (1u << DMACH_PONG);
-    irq_set_exclusive_handler(DMA_IRQ_0, dma_irq_handler);
-    irq_set_enabled(DMA_IRQ_0, true);
+    if (_ring_blocks) {
+        init_ring_dma();
+    }
+    else {
+        init_ping_pong_dma();
+    }
 
     bus_ctrl_hw->priority = BUSCTRL_BUS_PRIORITY_DMA_W_BITS | BUSCTRL_BUS_PRIORITY_DMA_R_BITS;
 
+    // The DMA starts on the first line of vblank, which no IRQ reports in
+    // either mode, so raise frame 0's vblank here by passing it from the
+    // line before
+    _beam_line_last = _v_total_lines - 1;
+    beam_event(0);
+
     // Start the DMA channels, which will start the HSTX output.
-    dma_channel_start(DMACH_PING);
+    dma_channel_start(_ring_blocks ? DMACH_RING : DMACH_PING);
 }
 
 void hstx_dvi_fill_row(hstx_dvi_row_t* r, hstx_dvi_pixel_t p) {
     uint32_t *x = (uint32_t*)r;
-#if MODE_BYTES_PER_PIXEL == 1
+#if MODE_BITS_PER_PIXEL == 8
     const uint32_t w = hstx_dvi_row_enc_pixel_quad(p, p, p, p);
-    for (int i = 0; i < MODE_H_ACTIVE_PIXELS >> 2; ++i) {
-        *x++ = w;
-    }
-#elif MODE_BYTES_PER_PIXEL == 2
+#elif MODE_BITS_PER_PIXEL == 16
     const uint32_t w = hstx_dvi_row_enc_pixel_pair(p, p);
-    for (int i = 0; i < MODE_H_ACTIVE_PIXELS >> 1; ++i) {
-        *x++ = w;
-    }   
 #else
-    #error "Unsupported MODE_BYTES_PER_PIXEL value"
+    // Replicate the packed pixel across the word
+    uint32_t w = p & HSTX_DVI_PIXEL_MASK;
+    for (uint32_t i = MODE_BITS_PER_PIXEL; i < 32; i <<= 1) {
+        w |= w << i;
+    }
 #endif
+    for (uint32_t i = 0; i < count_of(r->w); ++i) {
+        *x++ = w;
+    }
 }
 
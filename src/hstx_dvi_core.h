@@ -2,27 +2,41 @@
 
 //#include <sys/types.h>
 #include "pico/stdlib.h"
+#include "hstx_dvi_mode.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#define MODE_H_SYNC_POLARITY 0
-#define MODE_H_FRONT_PORCH   16
-#define MODE_H_SYNC_WIDTH    96
-#define MODE_H_BACK_PORCH    48
+// Row buffer geometry. The video timing is selected at run time (see
+// hstx_dvi_mode.h) and its active area, divided by any pixel repeat, must
+// fit in a row of this size.
+#ifndef MODE_H_ACTIVE_PIXELS
 #define MODE_H_ACTIVE_PIXELS 640
-
-#define MODE_V_SYNC_POLARITY 0
-#define MODE_V_FRONT_PORCH   10
-#define MODE_V_SYNC_WIDTH    2
-#define MODE_V_BACK_PORCH    33
+#endif
+#ifndef MODE_V_ACTIVE_LINES
 #define MODE_V_ACTIVE_LINES  480
+#endif
 
-#ifndef MODE_BYTES_PER_PIXEL
-#define MODE_BYTES_PER_PIXEL 1
+// Pixel format of rows, by bits per pixel:
+//   1  mono, white is half intensity as the encoder zero fills low bits
+//   2  grey
+//   4  RGB121
+//   8  RGB332
+//   16 RGB565
+// MODE_BYTES_PER_PIXEL (1 or 2) still selects the 8 and 16 bit formats.
+#ifndef MODE_BITS_PER_PIXEL
+#ifdef MODE_BYTES_PER_PIXEL
+#define MODE_BITS_PER_PIXEL (MODE_BYTES_PER_PIXEL * 8)
+#else
+#define MODE_BITS_PER_PIXEL 8
+#endif
+#endif
+#if MODE_BITS_PER_PIXEL >= 8 && !defined(MODE_BYTES_PER_PIXEL)
+#define MODE_BYTES_PER_PIXEL (MODE_BITS_PER_PIXEL / 8)
 #endif
-#define HSTX_DVI_BYTES_PER_ROW (MODE_BYTES_PER_PIXEL * MODE_H_ACTIVE_PIXELS)
+#define HSTX_DVI_BYTES_PER_ROW ((MODE_BITS_PER_PIXEL * MODE_H_ACTIVE_PIXELS + 7) >> 3)
+#define HSTX_DVI_PIXELS_PER_WORD (32 / MODE_BITS_PER_PIXEL)
 
 typedef union {
     uint8_t b[HSTX_DVI_BYTES_PER_ROW];
@@ -30,7 +44,65 @@ typedef union {
     uint32_t w[(HSTX_DVI_BYTES_PER_ROW + 3) >> 2];    
 } hstx_dvi_row_t __attribute__((aligned(4)));;
 
-#if MODE_BYTES_PER_PIXEL == 1
+#if MODE_BITS_PER_PIXEL < 8
+// Packed pixels, first pixel in the least significant bits. Setting a pixel
+// is a read-modify-write of its byte.
+typedef uint8_t hstx_dvi_pixel_t;
+#define HSTX_DVI_PIXELS_PER_BYTE (8 / MODE_BITS_PER_PIXEL)
+#define HSTX_DVI_PIXEL_MASK ((1u << MODE_BITS_PER_PIXEL) - 1)
+__force_inline void hstx_dvi_row_set_pixel(hstx_dvi_row_t* row, const uint32_t i, const uint32_t p) {
+    const uint32_t shift = (i & (HSTX_DVI_PIXELS_PER_BYTE - 1)) * MODE_BITS_PER_PIXEL;
+    uint8_t* b = &row->b[i / HSTX_DVI_PIXELS_PER_BYTE];
+    *b = (*b & ~(HSTX_DVI_PIXEL_MASK << shift)) | ((p & HSTX_DVI_PIXEL_MASK) << shift);
+}
+__force_inline void hstx_dvi_row_set_pixel_pair(hstx_dvi_row_t* row, const uint32_t i, const uint32_t p1, const uint32_t p2) {
+    const uint32_t j = i << 1;
+    hstx_dvi_row_set_pixel(row, j, p1);
+    hstx_dvi_row_set_pixel(row, j + 1, p2);
+}
+__force_inline void hstx_dvi_row_set_pixel_quad(
+    hstx_dvi_row_t* row, 
+    const uint32_t i, 
+    const uint32_t p1, 
+    const uint32_t p2,
+    const uint32_t p3, 
+    const uint32_t p4
+) {
+    const uint32_t j = i << 1;
+    hstx_dvi_row_set_pixel_pair(row, j, p1, p2);
+    hstx_dvi_row_set_pixel_pair(row, j + 1, p3, p4);
+}
+
+// Luma, 0 to 65280
+#define HSTX_DVI_PIXEL_LUMA(R, G, B) ((uint32_t)(R) * 77 + (uint32_t)(G) * 150 + (uint32_t)(B) * 29)
+
+#if MODE_BITS_PER_PIXEL == 1
+#define HSTX_DVI_PIXEL_RGB(R, G, B) (HSTX_DVI_PIXEL_LUMA(R, G, B) >> 15)
+__force_inline hstx_dvi_pixel_t hstx_dvi_pixel_dim(const hstx_dvi_pixel_t p) {
+    return 0;
+}
+#elif MODE_BITS_PER_PIXEL == 2
+#define HSTX_DVI_PIXEL_RGB(R, G, B) (HSTX_DVI_PIXEL_LUMA(R, G, B) >> 14)
+__force_inline hstx_dvi_pixel_t hstx_dvi_pixel_dim(const hstx_dvi_pixel_t p) {
+    return p >> 1;
+}
+#elif MODE_BITS_PER_PIXEL == 4
+#define HSTX_DVI_PIXEL_RGB(R, G, B) \
+    ((((uint32_t)(R) & 0x80) >> 4) | (((uint32_t)(G) & 0xc0) >> 5) | (((uint32_t)(B) & 0x80) >> 7))
+__force_inline hstx_dvi_pixel_t hstx_dvi_pixel_dim(const hstx_dvi_pixel_t p) {
+    return (p & 0b0100) >> 1;
+}
+#else
+    #error "Unsupported MODE_BITS_PER_PIXEL value"
+#endif
+
+__force_inline hstx_dvi_pixel_t hstx_dvi_pixel_rgb(const uint8_t r, const uint8_t g, const uint8_t b) {
+    return HSTX_DVI_PIXEL_RGB(r, g, b);
+}
+
+#elif MODE_BITS_PER_PIXEL != 8 && MODE_BITS_PER_PIXEL != 16
+    #error "Unsupported MODE_BITS_PER_PIXEL value"
+#elif MODE_BITS_PER_PIXEL == 8
 typedef uint8_t hstx_dvi_pixel_t; 
 __force_inline void hstx_dvi_row_set_pixel(hstx_dvi_row_t* row, const uint32_t i, const uint32_t rgb332) {
     row->b[i] = rgb332;
@@ -65,7 +137,7 @@ __force_inline hstx_dvi_pixel_t hstx_dvi_pixel_dim(const hstx_dvi_pixel_t p) {
     return ((p & 0b11000000) >> 1) | ((p & 0b00011000) >> 1)| ((p & 0b00000010) >> 1);
 }
 
-#elif MODE_BYTES_PER_PIXEL == 2
+#elif MODE_BITS_PER_PIXEL == 16
 typedef uint16_t hstx_dvi_pixel_t; 
 __force_inline void hstx_dvi_row_set_pixel(hstx_dvi_row_t* row, const uint32_t i, const uint32_t rgb565) {
     row->s[i] = rgb565;
@@ -101,13 +173,242 @@ __force_inline hstx_dvi_pixel_t hstx_dvi_pixel_rgb(const uint8_t r, const uint8_
 __force_inline hstx_dvi_pixel_t hstx_dvi_pixel_dim(const hstx_dvi_pixel_t p) {
     return ((p & 0b1111000000000000) >> 1) | ((p & 0b0000011111000000) >> 1)| ((p & 0b0000000000011110) >> 1);
 }
-#else
-    #error "Unsupported MODE_BYTES_PER_PIXEL value"
 #endif
 typedef hstx_dvi_row_t* (*hstx_dvi_pixel_row_fetcher)(uint32_t row_index);
 
+// Called from the DMA IRQ with a row the core has finished with, once the
+// last DMA transfer from it is done. Each fetched row is released once,
+// however many lines it was shown on. A row fetched again for the next row
+// index is still the same fetch.
+typedef void (*hstx_dvi_row_release_callback)(hstx_dvi_row_t* row);
+
+// ----------------------------------------------------------------------------
+// HSTX command expander
+
+#define HSTX_CMD_RAW         (0x0u << 12)
+#define HSTX_CMD_RAW_REPEAT  (0x1u << 12)
+#define HSTX_CMD_TMDS        (0x2u << 12)
+#define HSTX_CMD_TMDS_REPEAT (0x3u << 12)
+#define HSTX_CMD_NOP         (0xfu << 12)
+
+// HSTX_CMD_MAX_COUNT is in hstx_dvi_mode.h, which the mode validator shares
+
+// The HSTX FIFO depth in words. Anything DMA'd for a line should be at least
+// this long so the ping/pong channels cannot both finish before the IRQ has
+// reloaded one of them.
+#define HSTX_FIFO_WORDS 8
+
+// ----------------------------------------------------------------------------
+// Row descriptors
+//
+// A row fetcher can return a tagged reference to a descriptor in place of a
+// plain pixel row. The descriptor says what to DMA for the active part of the
+// line: either pixels, or a list of HSTX commands that produces the whole
+// active line itself (e.g. a span encoded row, see hstx_dvi_span.h).
+//
+// Pixels can be in any format, not just the one the build's rows use. The
+// core switches the HSTX encoder over in the horizontal blanking before the
+// row. Words must cover the mode's active width in that format (see
+// hstx_dvi_format_row_words) and rows in other formats are not repeated
+// horizontally. Neither are command lists, whatever their format: they
+// describe every pixel of the active line.
+
+#define HSTX_DVI_ROW_KIND_PIXELS 0
+#define HSTX_DVI_ROW_KIND_CMDS   1
+
+typedef enum {
+    HSTX_DVI_FORMAT_DEFAULT = 0,    // The MODE_BITS_PER_PIXEL format
+    HSTX_DVI_FORMAT_MONO1,
+    HSTX_DVI_FORMAT_GREY2,
+    HSTX_DVI_FORMAT_RGB121,
+    HSTX_DVI_FORMAT_RGB332,
+    HSTX_DVI_FORMAT_RGB565,
+    HSTX_DVI_FORMAT_COUNT
+} hstx_dvi_format_t;
+
+typedef struct {
+    const uint32_t* w;  // Words to DMA
+    uint16_t words;     // Number of words to DMA
+    uint8_t kind;       // HSTX_DVI_ROW_KIND_*
+    uint8_t format;     // HSTX_DVI_FORMAT_*, used by both kinds
+} hstx_dvi_row_desc_t;
+
+uint32_t hstx_dvi_format_bits(const hstx_dvi_format_t format);
+
+// Words in a row of pixels in the given format
+__force_inline uint32_t hstx_dvi_format_row_words(const hstx_dvi_format_t format, const uint32_t pixels) {
+    return (hstx_dvi_format_bits(format) * pixels + 31) >> 5;
+}
+
+// Rows are word aligned so bit 0 of a row pointer is free to tag descriptors
+#define HSTX_DVI_ROW_DESC_TAG 1u
+
+__force_inline hstx_dvi_row_t* hstx_dvi_row_desc_ref(const hstx_dvi_row_desc_t* d) {
+    return (hstx_dvi_row_t*)((uintptr_t)d | HSTX_DVI_ROW_DESC_TAG);
+}
+__force_inline bool hstx_dvi_row_is_desc(const hstx_dvi_row_t* r) {
+    return ((uintptr_t)r) & HSTX_DVI_ROW_DESC_TAG;
+}
+__force_inline const hstx_dvi_row_desc_t* hstx_dvi_row_get_desc(const hstx_dvi_row_t* r) {
+    return (const hstx_dvi_row_desc_t*)((uintptr_t)r & ~(uintptr_t)HSTX_DVI_ROW_DESC_TAG);
+}
+
+// Start DVI output in the default 640x480@60 mode
 void hstx_dvi_init(hstx_dvi_pixel_row_fetcher row_fetcher);
 
+// Start DVI output in the given mode. Panics if the mode fails validation
+// or does not fit the row buffer.
+void hstx_dvi_init_mode(const hstx_dvi_mode_t* mode, hstx_dvi_pixel_row_fetcher row_fetcher);
+
+const hstx_dvi_mode_t* hstx_dvi_get_mode();
+
+// Rows fetched per frame, the mode's active lines over the vertical repeat
+uint32_t hstx_dvi_get_row_count();
+
+// Show each row pixel h_repeat (1, 2 or 4) times across and each row
+// v_repeat times down, e.g. 2,2 for 320x240 rows in a 640x480 mode. The row
+// fetcher is then called once per v_repeat scanlines with the row index.
+// Horizontal repeat is done by the HSTX expander: each row pixel is one
+// narrow DMA write, which the bus copies across the FIFO word, and the
+// expander shifts it out h_repeat times. The expander rotates a word by a
+// fixed amount per pixel, so it can't show each pixel of a packed word more
+// than once. A line therefore takes h_active_pixels / h_repeat transfers:
+// at 2x that is as many as a full width row at 16 bpp and twice as many at
+// 8 bpp, and at 4x half and the same. Repeat saves row memory, rendering and
+// fetches. Horizontal repeat needs 8 or 16 bits per pixel, as a narrow write
+// of packed pixels would repeat the whole byte. Span rows encoded with
+// hstx_dvi_span_encode_repeat repeat with TMDS_REPEAT commands instead, at
+// any bits per pixel and never more words than a full width row. Call
+// before hstx_dvi_init.
+void hstx_dvi_set_repeat(const uint32_t h_repeat, const uint32_t v_repeat);
+
+// Drive the HSTX from a ring of DMA control blocks instead of taking two IRQs
+// per active line. The IRQ then only fires when half of the ring has been
+// used, to refill it, so rows are fetched up to a ring ahead of the beam.
+// blocks is even, >= 4 and <= HSTX_DVI_DMA_RING_MAX_BLOCKS (64 by default).
+// A vblank line takes 1 block and an active line 2, so a 640x480 frame is
+// 45 + 2 * 480 = 1005 blocks: a 64 block ring interrupts about 32 times a
+// frame where ping/pong takes 1005 IRQs. Each block of
+// HSTX_DVI_DMA_RING_MAX_BLOCKS costs 22 bytes of SRAM (the 16 byte control
+// block and 6 of bookkeeping), about 1.4 KB at 64. Pass 0 for the ping/pong
+// IRQ mode (the default). Call before hstx_dvi_init.
+void hstx_dvi_set_dma_ring(const uint32_t blocks);
+// The ring size set, 0 in ping/pong IRQ mode
+uint32_t hstx_dvi_get_dma_ring();
+
+// What to show when the row fetcher has no row ready for a line
+typedef enum {
+    HSTX_DVI_UNDERFLOW_DROP_FRAME = 0,  // Underflow colour for the rest of the frame
+    HSTX_DVI_UNDERFLOW_REPEAT_ROW,      // Show the last row again
+    HSTX_DVI_UNDERFLOW_BORDER,          // Underflow colour for the missed line only
+    HSTX_DVI_UNDERFLOW_RESYNC           // As BORDER, then throw away as many rows as
+                                        // were missed to catch up with the producer.
+                                        // Just BORDER with a tagged fetcher, see
+                                        // hstx_dvi_set_row_fetcher_tagged
+} hstx_dvi_underflow_policy_t;
+
+// Call before hstx_dvi_init. The default is HSTX_DVI_UNDERFLOW_DROP_FRAME
+// in green.
+void hstx_dvi_set_underflow_policy(const hstx_dvi_underflow_policy_t policy);
+void hstx_dvi_set_underflow_colour(const hstx_dvi_pixel_t colour);
+
+// Say the row fetcher hands out rows by line, as hstx_dvi_row_fifo does (its
+// init calls this). Such a fetcher already drops the rows for lines that
+// have gone, and has no row for a line once it has been asked for it, so
+// HSTX_DVI_UNDERFLOW_RESYNC throwing rows away would blank every line after
+// the first miss. It does no catching up with a tagged fetcher.
+void hstx_dvi_set_row_fetcher_tagged(const bool tagged);
+
+// Hand rows back to their owner (e.g. hstx_dvi_row_buf) when the core is done
+// with them. Call before hstx_dvi_init.
+void hstx_dvi_set_row_release_callback(hstx_dvi_row_release_callback callback);
+
+// Release a row that will never be shown, e.g. one a queue throws away
+void hstx_dvi_release_row(hstx_dvi_row_t* row);
+
+// Number of DMA IRQs since init, for measuring the IRQ rate
+uint32_t hstx_dvi_get_irq_count();
+
+// ----------------------------------------------------------------------------
+// Beam position and events
+//
+// Scanlines count the active area from 0, followed by the blanking lines, so
+// vblank starts at the mode's v_active_lines.
+
+#define HSTX_DVI_SCANLINE_NONE 0xffffffffu
+
+// Called from the DMA IRQ with the frame count and the scanline. The first
+// frame's vblank is raised from hstx_dvi_init, just before the DMA starts.
+typedef void (*hstx_dvi_scanline_callback)(uint32_t frame, uint32_t scanline);
+
+// Frames started since init, counted at the start of each vblank, so 1
+// during the first frame
+uint32_t hstx_dvi_get_frame_count();
+
+// The scanline the DMA is feeding to the HSTX
+uint32_t hstx_dvi_get_scanline();
+
+// The frame the row fetcher is being called for. It has the number
+// hstx_dvi_get_frame_count will return while the row is on screen.
+uint32_t hstx_dvi_get_fetch_frame();
+
+// Call back and/or SEV at the start of vblank. The callback may be NULL.
+void hstx_dvi_set_vblank_callback(hstx_dvi_scanline_callback callback, const bool sev);
+
+// Call back and/or SEV at the start of the given scanline. Call before
+// hstx_dvi_init.
+void hstx_dvi_set_scanline_callback(const uint32_t scanline, hstx_dvi_scanline_callback callback, const bool sev);
+
+// Wait for the start of the next vblank, sleeping in WFE if the vblank SEV
+// is enabled. Returns the new frame count.
+uint32_t hstx_dvi_wait_for_vblank();
+
+// ----------------------------------------------------------------------------
+// Scan-out statistics
+//
+// Build with HSTX_DVI_STATS=1 to collect per-frame timing and underflow
+// statistics in the DMA IRQ. They are published at the end of every frame and
+// can be read from either core without locking.
+
+#ifndef HSTX_DVI_STATS
+#define HSTX_DVI_STATS 0
+#endif
+
+#define HSTX_DVI_STATS_NONE 0xffffffffu
+
+// IRQ entry latency, measured as the number of words the next transfer has
+// already moved into the HSTX FIFO when the handler runs. Bucket i holds
+// latencies in [2^(i-1), 2^i), bucket 0 holds 0.
+#define HSTX_DVI_STATS_LATENCY_BUCKETS 8
+// Row queue fill level seen at each fetch, the last bucket holds anything
+// at or above it.
+#define HSTX_DVI_STATS_LEVEL_BUCKETS 16
+
+typedef struct {
+    uint32_t frame;                 // Frame these are for
+    uint32_t underflows;            // Rows the fetcher failed to deliver
+    uint32_t dropped_lines;         // Lines shown as the underflow row
+    uint32_t first_missed_line;     // First active line missed, or HSTX_DVI_STATS_NONE
+    uint32_t fetches;               // Calls to the row fetcher
+    uint32_t fetch_cycles_total;    // Cycles spent in the row fetcher
+    uint32_t fetch_cycles_max;      // Longest single call
+    uint32_t queue_level_min;       // Lowest row queue level seen at a fetch
+    uint32_t irq_latency_hist[HSTX_DVI_STATS_LATENCY_BUCKETS];
+    uint32_t queue_level_hist[HSTX_DVI_STATS_LEVEL_BUCKETS];
+    uint32_t total_underflows;      // Since init
+    uint32_t frames_with_underflow; // Since init
+} hstx_dvi_stats_t;
+
+// Returns the number of queued rows, sampled at each fetch
+typedef uint32_t (*hstx_dvi_queue_level_probe)();
+
+// Copy the statistics for the last complete frame. Returns false if the
+// statistics are not built in.
+bool hstx_dvi_stats_get(hstx_dvi_stats_t* stats);
+
+// Set how to sample the row queue level, e.g. hstx_dvi_row_fifo_get_level
+void hstx_dvi_stats_set_queue_level_probe(hstx_dvi_queue_level_probe probe);
+
 void hstx_dvi_fill_row(hstx_dvi_row_t* row, hstx_dvi_pixel_t pixel);
 
 //#define HSTX_DVI_MEM_LOC(A) __scratch_x("") A
@@ -94,7 +94,9 @@ void __not_in_flash_func(hstx_dvi_grid_render_frame)(uint32_t frame_index) {
     const bool blink = (frame_index & 63) < 32; // Blink every second for 32 frames
     hstx_dvi_pixel_t fgbg[2];
     for(uint32_t k = 0; k < MODE_V_ACTIVE_LINES; k++) {
-        hstx_dvi_row_t *r = hstx_dvi_row_buf_get();
+        // Don't render lines the scan-out has gone past
+        if (hstx_dvi_row_fifo_is_stale(frame_index, k)) continue;
+        hstx_dvi_row_t *r = hstx_dvi_row_buf_acquire();
         for (uint32_t j = 0; j < CHAR_COLS; j++) {
             const uint32_t s = _screen[k>>3][j];
             const uint32_t e = decode_char(s);
@@ -142,7 +144,7 @@ void __not_in_flash_func(hstx_dvi_grid_render_frame)(uint32_t frame_index) {
                 }
             }
         }
-        hstx_dvi_row_fifo_put_blocking(r);
+        hstx_dvi_row_fifo_put_blocking(r, frame_index, k);
     }
 }
 
@@ -191,7 +193,7 @@ void hstx_dvi_grid_init_all() {
     hstx_dvi_grid_init();
 
     // Initialize the HSTX DVI row FIFO.
-    hstx_dvi_row_fifo_init1(pio0);
+    hstx_dvi_row_fifo_init();
 
     multicore_launch_core1(hstx_dvi_grid_render_loop);
 }
@@ -200,7 +202,10 @@ void __not_in_flash_func(hstx_dvi_grid_render_loop)() {
 
     hstx_dvi_init(hstx_dvi_row_fifo_get_row_fetcher());
 
-    for(uint32_t frame_index = 0; true; ++frame_index) {
+    // Start on the frame the scan-out will fetch next
+    uint32_t frame_index, line;
+    hstx_dvi_row_fifo_get_expected(&frame_index, &line);
+    for(; true; ++frame_index) {
         hstx_dvi_grid_render_frame(frame_index);
     }
 }
@@ -0,0 +1,286 @@
+#include "hstx_dvi_mode.h"
+
+// ----------------------------------------------------------------------------
+// Mode table
+
+// DMT 640x480@60, pixel clock rounded up from 25.175MHz to 25.2MHz
+const hstx_dvi_mode_t hstx_dvi_mode_640x480_60 = {
+    .name = "640x480@60",
+    .h_active_pixels = 640, .h_front_porch = 16, .h_sync_width = 96, .h_back_porch = 48,
+    .v_active_lines = 480, .v_front_porch = 10, .v_sync_width = 2, .v_back_porch = 33,
+    .h_sync_polarity = HSTX_DVI_SYNC_NEGATIVE,
+    .v_sync_polarity = HSTX_DVI_SYNC_NEGATIVE,
+    .timing_std = HSTX_DVI_TIMING_DMT,
+    .hstx_clock_div = 2,
+    .pixel_clock_khz = 25200,
+    .sys_clock_khz = 252000
+};
+
+// CEA-861 720x480p@60 (VIC 2/3)
+const hstx_dvi_mode_t hstx_dvi_mode_720x480_60 = {
+    .name = "720x480@60",
+    .h_active_pixels = 720, .h_front_porch = 16, .h_sync_width = 62, .h_back_porch = 60,
+    .v_active_lines = 480, .v_front_porch = 9, .v_sync_width = 6, .v_back_porch = 30,
+    .h_sync_polarity = HSTX_DVI_SYNC_NEGATIVE,
+    .v_sync_polarity = HSTX_DVI_SYNC_NEGATIVE,
+    .timing_std = HSTX_DVI_TIMING_CEA,
+    .hstx_clock_div = 2,
+    .pixel_clock_khz = 27000,
+    .sys_clock_khz = 270000
+};
+
+// DMT 800x600@60, clk_hstx runs straight off a 200MHz clk_sys
+const hstx_dvi_mode_t hstx_dvi_mode_800x600_60 = {
+    .name = "800x600@60",
+    .h_active_pixels = 800, .h_front_porch = 40, .h_sync_width = 128, .h_back_porch = 88,
+    .v_active_lines = 600, .v_front_porch = 1, .v_sync_width = 4, .v_back_porch = 23,
+    .h_sync_polarity = HSTX_DVI_SYNC_POSITIVE,
+    .v_sync_polarity = HSTX_DVI_SYNC_POSITIVE,
+    .timing_std = HSTX_DVI_TIMING_DMT,
+    .hstx_clock_div = 1,
+    .pixel_clock_khz = 40000,
+    .sys_clock_khz = 200000
+};
+
+// CVT-RB 1280x720@30 (29.8Hz), pixel clock on the 0.25MHz CVT-RB grid
+const hstx_dvi_mode_t hstx_dvi_mode_1280x720_30_rb = {
+    .name = "1280x720@30R",
+    .h_active_pixels = 1280, .h_front_porch = 48, .h_sync_width = 32, .h_back_porch = 80,
+    .v_active_lines = 720, .v_front_porch = 3, .v_sync_width = 5, .v_back_porch = 6,
+    .h_sync_polarity = HSTX_DVI_SYNC_POSITIVE,
+    .v_sync_polarity = HSTX_DVI_SYNC_NEGATIVE,
+    .timing_std = HSTX_DVI_TIMING_CVT_RB,
+    .hstx_clock_div = 2,
+    .pixel_clock_khz = 31500,
+    .sys_clock_khz = 315000
+};
+
+const hstx_dvi_mode_t* const hstx_dvi_modes[] = {
+    &hstx_dvi_mode_640x480_60,
+    &hstx_dvi_mode_720x480_60,
+    &hstx_dvi_mode_800x600_60,
+    &hstx_dvi_mode_1280x720_30_rb
+};
+
+const uint32_t hstx_dvi_mode_count = sizeof(hstx_dvi_modes) / sizeof(hstx_dvi_modes[0]);
+
+// ----------------------------------------------------------------------------
+// Validator
+
+// Single link DVI
+#define DVI_MIN_PIXEL_CLOCK_KHZ 25000u
+#define DVI_MAX_PIXEL_CLOCK_KHZ 165000u
+
+// What monitors will generally lock to
+#define MIN_REFRESH_MHZ 23900u
+#define MAX_REFRESH_MHZ 86000u
+
+// CVT character cell
+#define CVT_CELL_GRAN 8u
+
+// CVT-RB (v1) fixed blanking
+#define CVT_RB_H_BLANK       160u
+#define CVT_RB_H_SYNC        32u
+#define CVT_RB_H_FRONT_PORCH 48u
+#define CVT_RB_V_FRONT_PORCH 3u
+#define CVT_RB_MIN_V_BLANK_NS 460000u
+
+// CVT (standard blanking)
+#define CVT_V_FRONT_PORCH      3u
+#define CVT_MIN_V_BACK_PORCH   6u
+#define CVT_MIN_VSYNC_BP_NS    550000u
+#define CVT_H_SYNC_PERCENT     8u
+
+// Duration of a number of lines in nanoseconds
+static uint64_t lines_ns(const hstx_dvi_mode_t* m, const uint32_t lines) {
+    return ((uint64_t)lines * hstx_dvi_mode_h_total(m) * 1000000u) / m->pixel_clock_khz;
+}
+
+static uint32_t validate_cvt_rb(const hstx_dvi_mode_t* m) {
+    uint32_t err = HSTX_DVI_MODE_OK;
+    const uint32_t h_blank = m->h_front_porch + m->h_sync_width + m->h_back_porch;
+    const uint32_t v_blank = m->v_front_porch + m->v_sync_width + m->v_back_porch;
+    if (h_blank != CVT_RB_H_BLANK ||
+        m->h_sync_width != CVT_RB_H_SYNC ||
+        m->h_front_porch != CVT_RB_H_FRONT_PORCH) {
+        err |= HSTX_DVI_MODE_ERR_H_BLANK;
+    }
+    if (m->v_front_porch != CVT_RB_V_FRONT_PORCH ||
+        m->v_back_porch < CVT_MIN_V_BACK_PORCH ||
+        lines_ns(m, v_blank) < CVT_RB_MIN_V_BLANK_NS) {
+        err |= HSTX_DVI_MODE_ERR_V_BLANK;
+    }
+    if (m->v_sync_width < 4) {
+        err |= HSTX_DVI_MODE_ERR_V_SYNC;
+    }
+    if (m->h_sync_polarity != HSTX_DVI_SYNC_POSITIVE ||
+        m->v_sync_polarity != HSTX_DVI_SYNC_NEGATIVE) {
+        err |= HSTX_DVI_MODE_ERR_POLARITY;
+    }
+    return err;
+}
+
+static uint32_t validate_cvt(const hstx_dvi_mode_t* m) {
+    uint32_t err = HSTX_DVI_MODE_OK;
+    const uint32_t h_total = hstx_dvi_mode_h_total(m);
+    const uint32_t h_blank = h_total - m->h_active_pixels;
+    // Sync is 8% of the line, rounded to the cell, and sits at the centre of
+    // the blanking interval
+    const uint32_t h_sync = ((h_total * CVT_H_SYNC_PERCENT) / 100 / CVT_CELL_GRAN) * CVT_CELL_GRAN;
+    const int32_t h_sync_err = (int32_t)m->h_sync_width - (int32_t)h_sync;
+    if (h_sync_err < -(int32_t)CVT_CELL_GRAN || h_sync_err > (int32_t)CVT_CELL_GRAN ||
+        ((uint32_t)m->h_back_porch << 1) != h_blank ||
+        (h_blank % (CVT_CELL_GRAN << 1)) != 0) {
+        err |= HSTX_DVI_MODE_ERR_H_BLANK;
+    }
+    if (m->v_front_porch != CVT_V_FRONT_PORCH ||
+        m->v_back_porch < CVT_MIN_V_BACK_PORCH ||
+        lines_ns(m, m->v_sync_width + m->v_back_porch) < CVT_MIN_VSYNC_BP_NS) {
+        err |= HSTX_DVI_MODE_ERR_V_BLANK;
+    }
+    if (m->v_sync_width < 4) {
+        err |= HSTX_DVI_MODE_ERR_V_SYNC;
+    }
+    if (m->h_sync_polarity != HSTX_DVI_SYNC_NEGATIVE ||
+        m->v_sync_polarity != HSTX_DVI_SYNC_POSITIVE) {
+        err |= HSTX_DVI_MODE_ERR_POLARITY;
+    }
+    return err;
+}
+
+// The published DMT and CEA-861 formats, found by active area and refresh
+typedef struct {
+    uint16_t h_active_pixels;
+    uint16_t v_active_lines;
+    uint8_t refresh_hz;
+    uint8_t h_sync_polarity;
+    uint8_t v_sync_polarity;
+    uint16_t h_front_porch;
+    uint16_t h_sync_width;
+    uint16_t h_back_porch;
+    uint16_t v_front_porch;
+    uint16_t v_sync_width;
+    uint16_t v_back_porch;
+} std_timing_t;
+
+#define P HSTX_DVI_SYNC_POSITIVE
+#define N HSTX_DVI_SYNC_NEGATIVE
+
+static const std_timing_t _dmt_timings[] = {
+    {  640, 480, 60, N, N,  16,  96,  48,  10, 2, 33 },
+    {  640, 480, 72, N, N,  24,  40, 128,   9, 3, 28 },
+    {  640, 480, 75, N, N,  16,  64, 120,   1, 3, 16 },
+    {  800, 600, 56, P, P,  24,  72, 128,   1, 2, 22 },
+    {  800, 600, 60, P, P,  40, 128,  88,   1, 4, 23 },
+    {  800, 600, 72, P, P,  56, 120,  64,  37, 6, 23 },
+    {  800, 600, 75, P, P,  16,  80, 160,   1, 3, 21 },
+    { 1024, 768, 60, N, N,  24, 136, 160,   3, 6, 29 },
+    { 1280, 720, 60, P, P, 110,  40, 220,   5, 5, 20 },
+};
+
+static const std_timing_t _cea_timings[] = {
+    {  640, 480, 60, N, N,  16,  96,  48,  10, 2, 33 },
+    {  720, 480, 60, N, N,  16,  62,  60,   9, 6, 30 },
+    {  720, 576, 50, N, N,  12,  64,  68,   5, 5, 39 },
+    { 1280, 720, 50, P, P, 440,  40, 220,   5, 5, 20 },
+    { 1280, 720, 60, P, P, 110,  40, 220,   5, 5, 20 },
+};
+
+#undef P
+#undef N
+
+static const std_timing_t* find_std_timing(const hstx_dvi_mode_t* m, const std_timing_t* t, const uint32_t n) {
+    // Within a hertz, as the pixel clock is rounded to what the PLL can make
+    const uint32_t refresh = (hstx_dvi_mode_refresh_mhz(m) + 500u) / 1000u;
+    for (uint32_t i = 0; i < n; ++i, ++t) {
+        if (t->h_active_pixels == m->h_active_pixels &&
+            t->v_active_lines == m->v_active_lines &&
+            refresh + 1u >= t->refresh_hz && refresh <= t->refresh_hz + 1u) {
+            return t;
+        }
+    }
+    return 0;
+}
+
+// DMT and CEA modes have their blanking published format by format, rather
+// than worked out from rules as CVT, so compare against the format with the
+// same active area and refresh.
+static uint32_t validate_std(const hstx_dvi_mode_t* m) {
+    uint32_t err = HSTX_DVI_MODE_OK;
+    const std_timing_t* t = m->timing_std == HSTX_DVI_TIMING_CEA
+        ? find_std_timing(m, _cea_timings, sizeof(_cea_timings) / sizeof(_cea_timings[0]))
+        : find_std_timing(m, _dmt_timings, sizeof(_dmt_timings) / sizeof(_dmt_timings[0]));
+    if (!t) {
+        return HSTX_DVI_MODE_ERR_STD_FORMAT;
+    }
+    if (m->h_front_porch != t->h_front_porch ||
+        m->h_sync_width != t->h_sync_width ||
+        m->h_back_porch != t->h_back_porch) {
+        err |= HSTX_DVI_MODE_ERR_H_BLANK;
+    }
+    if (m->v_front_porch != t->v_front_porch ||
+        m->v_back_porch != t->v_back_porch) {
+        err |= HSTX_DVI_MODE_ERR_V_BLANK;
+    }
+    if (m->v_sync_width != t->v_sync_width) {
+        err |= HSTX_DVI_MODE_ERR_V_SYNC;
+    }
+    if (m->h_sync_polarity != t->h_sync_polarity ||
+        m->v_sync_polarity != t->v_sync_polarity) {
+        err |= HSTX_DVI_MODE_ERR_POLARITY;
+    }
+    return err;
+}
+
+uint32_t hstx_dvi_mode_validate(const hstx_dvi_mode_t* m) {
+    if (!m) return HSTX_DVI_MODE_ERR_GEOMETRY;
+
+    uint32_t err = HSTX_DVI_MODE_OK;
+
+    if (!m->h_active_pixels || !m->h_front_porch || !m->h_sync_width || !m->h_back_porch ||
+        !m->v_active_lines || !m->v_front_porch || !m->v_sync_width || !m->v_back_porch) {
+        // Nothing else is meaningful
+        return HSTX_DVI_MODE_ERR_GEOMETRY;
+    }
+    if (m->h_active_pixels % CVT_CELL_GRAN) {
+        err |= HSTX_DVI_MODE_ERR_H_ALIGN;
+    }
+    if (m->h_front_porch > HSTX_CMD_MAX_COUNT ||
+        m->h_sync_width > HSTX_CMD_MAX_COUNT ||
+        (m->h_back_porch + m->h_active_pixels) > HSTX_CMD_MAX_COUNT) {
+        err |= HSTX_DVI_MODE_ERR_HSTX_COUNT;
+    }
+    if (!m->hstx_clock_div ||
+        m->sys_clock_khz != m->pixel_clock_khz * 5u * m->hstx_clock_div) {
+        err |= HSTX_DVI_MODE_ERR_CLOCK;
+    }
+    if (m->pixel_clock_khz < DVI_MIN_PIXEL_CLOCK_KHZ ||
+        m->pixel_clock_khz > DVI_MAX_PIXEL_CLOCK_KHZ) {
+        // The refresh and blanking time checks need a sane pixel clock
+        return err | HSTX_DVI_MODE_ERR_PIXEL_CLOCK;
+    }
+    const uint32_t refresh = hstx_dvi_mode_refresh_mhz(m);
+    if (refresh < MIN_REFRESH_MHZ || refresh > MAX_REFRESH_MHZ) {
+        err |= HSTX_DVI_MODE_ERR_REFRESH;
+    }
+    if (m->v_sync_width < 2 || m->v_sync_width > 10) {
+        err |= HSTX_DVI_MODE_ERR_V_SYNC;
+    }
+
+    switch (m->timing_std) {
+        case HSTX_DVI_TIMING_CVT_RB:
+            err |= validate_cvt_rb(m);
+            break;
+        case HSTX_DVI_TIMING_CVT:
+            err |= validate_cvt(m);
+            break;
+        case HSTX_DVI_TIMING_DMT:
+        case HSTX_DVI_TIMING_CEA:
+            err |= validate_std(m);
+            break;
+        default:
+            err |= HSTX_DVI_MODE_ERR_GEOMETRY;
+            break;
+    }
+    return err;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+// Video timing descriptors for the HSTX DVI core.
+//
+// This header (and hstx_dvi_mode.c) deliberately only depends on the C
+// standard library so the mode table and its validator can also be built
+// and run on a host machine.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HSTX_DVI_SYNC_NEGATIVE 0
+#define HSTX_DVI_SYNC_POSITIVE 1
+
+// The standard a mode claims to follow, selects the validator rule set.
+typedef enum {
+    HSTX_DVI_TIMING_DMT = 0,    // VESA Display Monitor Timing
+    HSTX_DVI_TIMING_CEA,        // CEA-861 (TV formats)
+    HSTX_DVI_TIMING_CVT,        // VESA Coordinated Video Timing
+    HSTX_DVI_TIMING_CVT_RB      // CVT reduced blanking
+} hstx_dvi_timing_std_t;
+
+typedef struct {
+    const char *name;
+
+    uint16_t h_active_pixels;
+    uint16_t h_front_porch;
+    uint16_t h_sync_width;
+    uint16_t h_back_porch;
+
+    uint16_t v_active_lines;
+    uint16_t v_front_porch;
+    uint16_t v_sync_width;
+    uint16_t v_back_porch;
+
+    uint8_t h_sync_polarity;
+    uint8_t v_sync_polarity;
+    uint8_t timing_std;
+
+    // The HSTX shifts out 10 TMDS bits per pixel over 5 cycles of clk_hstx
+    // (2 bits per cycle, DDR), so clk_hstx must be 5x the pixel clock:
+    //   sys_clock_khz == pixel_clock_khz * 5 * hstx_clock_div
+    uint8_t hstx_clock_div;
+    uint32_t pixel_clock_khz;
+    uint32_t sys_clock_khz;
+} hstx_dvi_mode_t;
+
+extern const hstx_dvi_mode_t hstx_dvi_mode_640x480_60;
+extern const hstx_dvi_mode_t hstx_dvi_mode_720x480_60;
+extern const hstx_dvi_mode_t hstx_dvi_mode_800x600_60;
+extern const hstx_dvi_mode_t hstx_dvi_mode_1280x720_30_rb;
+
+// All of the above, for iterating over (e.g. in a validator run).
+extern const hstx_dvi_mode_t* const hstx_dvi_modes[];
+extern const uint32_t hstx_dvi_mode_count;
+
+// Validator error bits
+#define HSTX_DVI_MODE_OK                 (0x0000)
+#define HSTX_DVI_MODE_ERR_GEOMETRY       (0x0001) // zero sized active area, porch or sync
+#define HSTX_DVI_MODE_ERR_H_ALIGN        (0x0002) // active width not a multiple of the character cell
+#define HSTX_DVI_MODE_ERR_HSTX_COUNT     (0x0004) // a run does not fit the 12-bit HSTX command count
+#define HSTX_DVI_MODE_ERR_CLOCK          (0x0008) // sys/HSTX clocks do not produce the pixel clock
+#define HSTX_DVI_MODE_ERR_PIXEL_CLOCK    (0x0010) // pixel clock outside of the single link DVI range
+#define HSTX_DVI_MODE_ERR_REFRESH        (0x0020) // vertical refresh outside of what monitors accept
+#define HSTX_DVI_MODE_ERR_V_SYNC         (0x0040) // vertical sync width out of range
+#define HSTX_DVI_MODE_ERR_H_BLANK        (0x0080) // horizontal blanking breaks the standard's rules
+#define HSTX_DVI_MODE_ERR_V_BLANK        (0x0100) // vertical blanking breaks the standard's rules
+#define HSTX_DVI_MODE_ERR_POLARITY       (0x0200) // sync polarity does not match the standard
+#define HSTX_DVI_MODE_ERR_STD_FORMAT     (0x0400) // no DMT/CEA format with this active area and refresh
+
+// Largest count that fits in an HSTX command word
+#define HSTX_CMD_MAX_COUNT (0xfffu)
+
+static inline uint32_t hstx_dvi_mode_h_total(const hstx_dvi_mode_t* m) {
+    return m->h_front_porch + m->h_sync_width + m->h_back_porch + m->h_active_pixels;
+}
+
+static inline uint32_t hstx_dvi_mode_v_total(const hstx_dvi_mode_t* m) {
+    return m->v_front_porch + m->v_sync_width + m->v_back_porch + m->v_active_lines;
+}
+
+// Vertical refresh rate in milli-Hertz
+static inline uint32_t hstx_dvi_mode_refresh_mhz(const hstx_dvi_mode_t* m) {
+    const uint64_t t = (uint64_t)hstx_dvi_mode_h_total(m) * hstx_dvi_mode_v_total(m);
+    return t ? (uint32_t)(((uint64_t)m->pixel_clock_khz * 1000000u) / t) : 0;
+}
+
+// Check a mode against the generic DVI/HSTX constraints and the standard it
+// claims to follow: the CVT and CVT-RB rules, or for DMT and CEA the
+// published format with the same active area and refresh. Returns a mask of
+// HSTX_DVI_MODE_ERR_* bits, HSTX_DVI_MODE_OK if the mode is good.
+uint32_t hstx_dvi_mode_validate(const hstx_dvi_mode_t* mode);
+
+#ifdef __cplusplus
+}
+#endif
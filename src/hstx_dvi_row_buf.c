@@ -1,25 +1,104 @@
-#include "hstx_dvi_core.h"
-#include "hstx_dvi_row_fifo.h"
+#include "hstx_dvi_row_buf.h"
+#include "hardware/sync.h"
 
-// TODO Why do I need to add 4 to this!
-#define ROW_BUF_SIZE (HSTX_DVI_ROW_FIFO_SIZE + 4)
-static hstx_dvi_row_t row[ROW_BUF_SIZE];
-static uint32_t row_index = 0;
+static hstx_dvi_row_t HSTX_DVI_ROW_BUF_MEM row[HSTX_DVI_ROW_BUF_SIZE];
+
+// The free rows, as a ring with a spare slot so full and empty differ. The
+// renderer takes from the tail and the core gives back at the head. With
+// more than one renderer core each has its own share of the rows, which
+// always go back to the same lane.
+#define FREE_SLOTS (HSTX_DVI_ROW_BUF_SIZE + 1)
+
+typedef struct {
+    hstx_dvi_row_t* free[FREE_SLOTS];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    // The fewest free rows the renderer has left
+    uint32_t low;
+} row_buf_lane_t;
+
+static row_buf_lane_t _lanes[HSTX_DVI_ROW_FIFO_LANES];
+
+static __force_inline uint32_t next_slot(const uint32_t i) {
+    return i + 1 == FREE_SLOTS ? 0 : i + 1;
+}
+
+static __force_inline uint32_t lane_free(const row_buf_lane_t* l) {
+    const uint32_t head = l->head;
+    const uint32_t tail = l->tail;
+    return head >= tail ? head - tail : head + FREE_SLOTS - tail;
+}
+
+static __force_inline void lane_put(row_buf_lane_t* l, hstx_dvi_row_t* r) {
+    const uint32_t head = l->head;
+    l->free[head] = r;
+    // Publish the row after it
+    __dmb();
+    l->head = next_slot(head);
+}
 
 void hstx_dvi_row_buf_init() {
+    const uint32_t ring = hstx_dvi_get_dma_ring();
+    if (HSTX_DVI_ROW_BUF_SIZE / HSTX_DVI_ROW_FIFO_LANES < HSTX_DVI_ROW_FIFO_SIZE + 1 + HSTX_DVI_ROW_BUF_CORE_ROWS(ring)) {
+        panic("hstx_dvi: a row pool of %u is too small for a %u block DMA ring, set HSTX_DVI_ROW_BUF_RING_BLOCKS",
+            (uint)HSTX_DVI_ROW_BUF_SIZE, (uint)ring);
+    }
+    for (uint32_t i = 0; i < HSTX_DVI_ROW_FIFO_LANES; ++i) {
+        _lanes[i].head = 0;
+        _lanes[i].tail = 0;
+        _lanes[i].low = HSTX_DVI_ROW_BUF_SIZE;
+    }
     // Initialize the row buffer with zeros
-    for (uint32_t i = 0; i < ROW_BUF_SIZE; ++i) {
+    for (uint32_t i = 0; i < HSTX_DVI_ROW_BUF_SIZE; ++i) {
         for (uint32_t j = 0; j < HSTX_DVI_BYTES_PER_ROW; ++j) {
             row[i].b[j] = 0;
         }
+        lane_put(&_lanes[i % HSTX_DVI_ROW_FIFO_LANES], &row[i]);
     }
+    hstx_dvi_set_row_release_callback(hstx_dvi_row_buf_release);
 }
 
-hstx_dvi_row_t* __not_in_flash_func(hstx_dvi_row_buf_get)() {
-    // Return the next row in the buffer, wrapping around if necessary
-    hstx_dvi_row_t* current_row = &row[row_index];
-    ++row_index;
-    if (row_index >= ROW_BUF_SIZE) row_index=0;
-    return current_row;
+hstx_dvi_row_t* __not_in_flash_func(hstx_dvi_row_buf_acquire)() {
+#if HSTX_DVI_ROW_FIFO_LANES > 1
+    row_buf_lane_t* l = &_lanes[get_core_num()];
+#else
+    row_buf_lane_t* l = &_lanes[0];
+#endif
+    const uint32_t tail = l->tail;
+    while (l->head == tail) {
+        __wfe();
+    }
+    // Read the slot after seeing the head that published it
+    __dmb();
+    hstx_dvi_row_t* r = l->free[tail];
+    __dmb();
+    l->tail = next_slot(tail);
+    const uint32_t n = lane_free(l);
+    if (n < l->low) l->low = n;
+    return r;
 }
 
+void HSTX_DVI_MEM_LOC(hstx_dvi_row_buf_release)(hstx_dvi_row_t* r) {
+    lane_put(&_lanes[(uint32_t)(r - row) % HSTX_DVI_ROW_FIFO_LANES], r);
+    // Wake the renderer if it is waiting for a row
+    __sev();
+}
+
+uint32_t hstx_dvi_row_buf_get_free() {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < HSTX_DVI_ROW_FIFO_LANES; ++i) {
+        n += lane_free(&_lanes[i]);
+    }
+    return n;
+}
+
+uint32_t hstx_dvi_row_buf_get_high_water() {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < HSTX_DVI_ROW_FIFO_LANES; ++i) {
+        // Each lane starts with its share of the rows
+        const uint32_t lane_rows = (HSTX_DVI_ROW_BUF_SIZE + HSTX_DVI_ROW_FIFO_LANES - 1 - i) / HSTX_DVI_ROW_FIFO_LANES;
+        const uint32_t low = _lanes[i].low;
+        n += low < lane_rows ? lane_rows - low : 0;
+    }
+    return n;
+}
@@ -5,11 +5,53 @@ extern "C" {
 #endif
 
 #include "hstx_dvi_core.h"
+#include "hstx_dvi_row_fifo.h"
 
+// A pool of rows for the renderer. Rows are acquired by the renderer and
+// given back by the core (see hstx_dvi_set_row_release_callback) when the
+// DMA has finished with them, so a row is never drawn on while it is being
+// shown. An empty pool parks the renderer in WFE until a row is released.
+
+// The DMA ring (see hstx_dvi_set_dma_ring) the pool is sized for, 0 for
+// ping/pong IRQ mode
+#ifndef HSTX_DVI_ROW_BUF_RING_BLOCKS
+#define HSTX_DVI_ROW_BUF_RING_BLOCKS 0
+#endif
+
+// Rows the core holds on to with a ring of this many blocks. In ping/pong
+// mode that is the row being shown, the one posted after it and one retired
+// but not yet given back. In ring mode a row is kept for a lap of the ring,
+// which has an active line every two blocks at most.
+#define HSTX_DVI_ROW_BUF_CORE_ROWS(ring_blocks) ((ring_blocks) ? (ring_blocks) / 2 + 2 : 3)
+
+// Rows in the pool. It needs to cover the row queue, a row being drawn and
+// the rows the core holds on to. With two queue lanes each core gets half of
+// them.
+#ifndef HSTX_DVI_ROW_BUF_SIZE
+#define HSTX_DVI_ROW_BUF_SIZE \
+    ((HSTX_DVI_ROW_FIFO_SIZE + 1 + HSTX_DVI_ROW_BUF_CORE_ROWS(HSTX_DVI_ROW_BUF_RING_BLOCKS)) * HSTX_DVI_ROW_FIFO_LANES)
+#endif
+
+// Where the rows go, e.g. __scratch_x("") to keep a small pool out of the
+// main SRAM banks
+#ifndef HSTX_DVI_ROW_BUF_MEM
+#define HSTX_DVI_ROW_BUF_MEM
+#endif
+
+// Clears the rows, fills the pool and registers the release callback. Panics
+// if the pool is too small for the DMA ring, so call after
+// hstx_dvi_set_dma_ring.
 void hstx_dvi_row_buf_init();
-hstx_dvi_row_t* hstx_dvi_row_buf_get();
+hstx_dvi_row_t* hstx_dvi_row_buf_acquire();
+// Only from the scan-out side, usually via the release callback
+void hstx_dvi_row_buf_release(hstx_dvi_row_t* row);
+// Rows in the pool
+uint32_t hstx_dvi_row_buf_get_free();
+// The most rows that have been out of the pool at once since init. With two
+// lanes it is the sum of each lane's most. HSTX_DVI_ROW_BUF_SIZE means the
+// renderer has run out of rows.
+uint32_t hstx_dvi_row_buf_get_high_water();
 
 #ifdef __cplusplus
 } 
 #endif
-
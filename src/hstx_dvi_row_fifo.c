@@ -1,50 +1,172 @@
-#include "hardware/pio.h"
 #include "hstx_dvi_row_fifo.h"
-#include "hstx_dvi_row_fifo.pio.h"
+#include "hardware/sync.h"
 
+#if HSTX_DVI_ROW_FIFO_SIZE & (HSTX_DVI_ROW_FIFO_SIZE - 1)
+#error "HSTX_DVI_ROW_FIFO_SIZE must be a power of 2"
+#endif
+#if HSTX_DVI_ROW_FIFO_LANES != 1 && HSTX_DVI_ROW_FIFO_LANES != 2
+#error "HSTX_DVI_ROW_FIFO_LANES must be 1 or 2"
+#endif
 
-static PIO _pio = pio0;
-static uint _sm = 0;
+#define ROW_FIFO_MASK (HSTX_DVI_ROW_FIFO_SIZE - 1)
 
-hstx_dvi_row_t* HSTX_DVI_MEM_LOC(hstx_dvi_row_fifo_get)(uint32_t row_index) {
-    // Wait for data to be available in the RX FIFO
-    if (pio_sm_is_rx_fifo_empty(_pio, _sm)) return 0;
+// Positions pack the frame above the line, which always fits the 12 bits of
+// an HSTX count. They wrap with the frame (so frames are only told apart
+// modulo 2^20), so compare them by the sign of their difference.
+#define POS_LINE_BITS 12
+#define POS_LINE_MASK ((1u << POS_LINE_BITS) - 1)
+
+typedef struct {
+    hstx_dvi_row_t* row;
+    uint32_t pos;
+} row_fifo_entry_t;
 
-    // Read data from the RX FIFO
-    return (hstx_dvi_row_t*)_pio->rxf[_sm];
+static __force_inline uint32_t pos_of(const uint32_t frame, const uint32_t line) {
+    return (frame << POS_LINE_BITS) | line;
 }
 
-void fifo_passthrough_program_init(PIO pio, uint sm, uint offset) {
-    pio_sm_config c = fifo_passthrough_program_get_default_config(offset);
-    sm_config_set_in_shift(&c, true, false, 32);  // Auto-push 32-bit to RX
-    sm_config_set_out_shift(&c, true, false, 32); // Auto-pull 32-bit from TX
-    sm_config_set_clkdiv(&c, 1.0f);
-    pio_sm_init(pio, sm, offset, &c);
-    pio_sm_set_enabled(pio, sm, true);
+static __force_inline int32_t pos_diff(const uint32_t a, const uint32_t b) {
+    return (int32_t)(a - b);
 }
 
-hstx_dvi_pixel_row_fetcher hstx_dvi_row_fifo_init(PIO pio, uint sm) {
-    _pio = pio;
-    _sm = sm;
+// The indexes run freely and wrap at 2^32, so head - tail is always the
+// level. Only the lane's producer writes its head and only the consumer
+// writes the tails.
+typedef struct {
+    row_fifo_entry_t entries[HSTX_DVI_ROW_FIFO_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+} row_fifo_lane_t;
 
-    // Load the PIO program
-    uint offset = pio_add_program(pio, &fifo_passthrough_program);
-    fifo_passthrough_program_init(pio, sm, offset);
+static row_fifo_lane_t _lanes[HSTX_DVI_ROW_FIFO_LANES];
+// The position the scan-out last fetched, written by the consumer. It
+// starts as just before the first line of frame 1.
+#define POS_START POS_LINE_MASK
+static volatile uint32_t _fetched = POS_START;
 
-    sleep_ms(200); // Allow time for the PIO program to initialize
+// Look for the wanted row at the front of a lane
+static __force_inline hstx_dvi_row_t* lane_get(row_fifo_lane_t* l, const uint32_t want) {
+    hstx_dvi_row_t* row = 0;
+    uint32_t tail = l->tail;
+    // Never more than a lane's worth of stale rows to get through
+    while (l->head != tail) {
+        // Read the entry after seeing the head that published it
+        __dmb();
+        const row_fifo_entry_t* e = &l->entries[tail & ROW_FIFO_MASK];
+        const int32_t d = pos_diff(e->pos, want);
+        // Hold on to rows for lines still to come, and give back those for
+        // lines already gone
+        if (d > 0) break;
+        if (d == 0) row = e->row;
+        else hstx_dvi_release_row(e->row);
+        // Finish with the slot before handing it back
+        __dmb();
+        l->tail = ++tail;
+        if (row) break;
+    }
+    return row;
+}
+
+hstx_dvi_row_t* HSTX_DVI_MEM_LOC(hstx_dvi_row_fifo_get)(uint32_t row_index) {
+    const uint32_t want = pos_of(hstx_dvi_get_fetch_frame(), row_index);
+    _fetched = want;
+    hstx_dvi_row_t* row = lane_get(&_lanes[0], want);
+#if HSTX_DVI_ROW_FIFO_LANES > 1
+    // Both lanes are in line order, so the other lane is still cleared of
+    // stale rows when the first has the one wanted
+    hstx_dvi_row_t* row1 = lane_get(&_lanes[1], want);
+    if (!row) row = row1;
+    else if (row1) hstx_dvi_release_row(row1);
+#endif
+    // Wake the producers if they are waiting for room
+    __sev();
+    return row;
+}
 
+hstx_dvi_pixel_row_fetcher hstx_dvi_row_fifo_init() {
+    for (uint32_t i = 0; i < HSTX_DVI_ROW_FIFO_LANES; ++i) {
+        _lanes[i].head = 0;
+        _lanes[i].tail = 0;
+    }
+    _fetched = POS_START;
+    hstx_dvi_set_row_fetcher_tagged(true);
     return hstx_dvi_row_fifo_get;
 }
 
-hstx_dvi_pixel_row_fetcher hstx_dvi_row_fifo_init1(PIO pio) {
-    uint sm = pio_claim_unused_sm(pio, true);
-    return hstx_dvi_row_fifo_init(pio, sm);
+// The lane the calling core puts into
+static __force_inline row_fifo_lane_t* own_lane() {
+#if HSTX_DVI_ROW_FIFO_LANES > 1
+    return &_lanes[get_core_num()];
+#else
+    return &_lanes[0];
+#endif
+}
+
+static __force_inline void lane_put(row_fifo_lane_t* l, const uint32_t head, hstx_dvi_row_t* row, const uint32_t pos) {
+    // Don't write the slot until the consumer has finished with it
+    __dmb();
+    row_fifo_entry_t* e = &l->entries[head & ROW_FIFO_MASK];
+    e->row = row;
+    e->pos = pos;
+    // Publish the entry after it, and everything the renderer wrote to the row
+    __dmb();
+    l->head = head + 1;
+}
+
+void __not_in_flash_func(hstx_dvi_row_fifo_put_blocking)(hstx_dvi_row_t* row, uint32_t frame, uint32_t line){
+    row_fifo_lane_t* l = own_lane();
+    const uint32_t head = l->head;
+    while (head - l->tail >= HSTX_DVI_ROW_FIFO_SIZE) {
+        __wfe();
+    }
+    lane_put(l, head, row, pos_of(frame, line));
 }
 
-void __not_in_flash_func(hstx_dvi_row_fifo_put_blocking)(hstx_dvi_row_t* row){
-    pio_sm_put_blocking(_pio, _sm, (uint32_t)row);
+bool __not_in_flash_func(hstx_dvi_row_fifo_try_put)(hstx_dvi_row_t* row, uint32_t frame, uint32_t line){
+    row_fifo_lane_t* l = own_lane();
+    const uint32_t head = l->head;
+    if (head - l->tail >= HSTX_DVI_ROW_FIFO_SIZE) return false;
+    lane_put(l, head, row, pos_of(frame, line));
+    return true;
+}
+
+uint32_t __not_in_flash_func(hstx_dvi_row_fifo_get_own_level)() {
+    const row_fifo_lane_t* l = own_lane();
+    return l->head - l->tail;
+}
+
+void __not_in_flash_func(hstx_dvi_row_fifo_wait_level)(uint32_t level) {
+    const row_fifo_lane_t* l = own_lane();
+    // Every fetch by the scan-out sends an event
+    while (l->head - l->tail > level) {
+        __wfe();
+    }
 }
 
 hstx_dvi_pixel_row_fetcher hstx_dvi_row_fifo_get_row_fetcher() {
     return hstx_dvi_row_fifo_get;
 }
+
+uint32_t HSTX_DVI_MEM_LOC(hstx_dvi_row_fifo_get_level)() {
+    uint32_t level = 0;
+    for (uint32_t i = 0; i < HSTX_DVI_ROW_FIFO_LANES; ++i) {
+        level += _lanes[i].head - _lanes[i].tail;
+    }
+    return level;
+}
+
+void hstx_dvi_row_fifo_get_expected(uint32_t* frame, uint32_t* line) {
+    const uint32_t fetched = _fetched;
+    uint32_t f = fetched >> POS_LINE_BITS;
+    uint32_t l = (fetched & POS_LINE_MASK) + 1;
+    if (l >= hstx_dvi_get_row_count()) {
+        l = 0;
+        ++f;
+    }
+    *frame = f;
+    *line = l;
+}
+
+bool __not_in_flash_func(hstx_dvi_row_fifo_is_stale)(uint32_t frame, uint32_t line) {
+    return pos_diff(pos_of(frame, line), _fetched) <= 0;
+}
@@ -5,17 +5,60 @@ extern "C" {
 #endif
 
 #include "hstx_dvi_core.h"
-#include "hardware/pio.h"
 
+// Single producer, single consumer queue of rows in SRAM. The renderer (on
+// the other core) puts rows and the scan-out IRQ takes them. A full queue
+// parks the renderer in WFE until the scan-out takes a row.
+//
+// Each row is tagged with the frame (see hstx_dvi_get_fetch_frame) and line
+// it is for. The scan-out throws away rows for lines it has already passed
+// and holds on to rows for lines it has not reached yet, so a stall costs
+// the lines it covers and no more. Use hstx_dvi_row_fifo_is_stale to skip
+// rendering those lines.
+//
+// The queue does its own catching up, so hstx_dvi_row_fifo_init tells the
+// core the fetcher is tagged and HSTX_DVI_UNDERFLOW_RESYNC acts as
+// HSTX_DVI_UNDERFLOW_BORDER.
+//
+// With HSTX_DVI_ROW_FIFO_LANES 2 both cores can render. Each core puts into
+// a lane of its own, in line order, and the scan-out merges the lanes by
+// tag. Which core renders which line is up to the renderer.
+
+// Rows the queue can hold, a power of 2
+#ifndef HSTX_DVI_ROW_FIFO_SIZE
 #define HSTX_DVI_ROW_FIFO_SIZE 8
+#endif
 
-hstx_dvi_pixel_row_fetcher hstx_dvi_row_fifo_init(PIO pio, uint sm);
-hstx_dvi_pixel_row_fetcher hstx_dvi_row_fifo_init1(PIO pio);
-void hstx_dvi_row_fifo_put_blocking(hstx_dvi_row_t* row);
+// Cores putting rows, 1 or 2. Each lane holds HSTX_DVI_ROW_FIFO_SIZE rows.
+#ifndef HSTX_DVI_ROW_FIFO_LANES
+#define HSTX_DVI_ROW_FIFO_LANES 1
+#endif
+
+hstx_dvi_pixel_row_fetcher hstx_dvi_row_fifo_init();
+void hstx_dvi_row_fifo_put_blocking(hstx_dvi_row_t* row, uint32_t frame, uint32_t line);
 hstx_dvi_row_t* hstx_dvi_row_fifo_get(uint32_t row_index);
 hstx_dvi_pixel_row_fetcher hstx_dvi_row_fifo_get_row_fetcher();
+uint32_t hstx_dvi_row_fifo_get_level();
+
+// Put a row if there is room for it, without waiting. Returns false, with
+// the row still the caller's, if the lane is full.
+bool hstx_dvi_row_fifo_try_put(hstx_dvi_row_t* row, uint32_t frame, uint32_t line);
+
+// Rows queued by the calling core, i.e. how far it is ahead of the beam.
+// Use hstx_dvi_row_fifo_get_level for all the lanes.
+uint32_t hstx_dvi_row_fifo_get_own_level();
+
+// Wait in WFE until the calling core has at most level rows queued. A
+// renderer that is well ahead can do other work and then wait here, rather
+// than in hstx_dvi_row_fifo_put_blocking, for the scan-out to catch up.
+void hstx_dvi_row_fifo_wait_level(uint32_t level);
+
+// The frame and line the scan-out will fetch next
+void hstx_dvi_row_fifo_get_expected(uint32_t* frame, uint32_t* line);
+
+// Has the scan-out already fetched (or given up on) this line?
+bool hstx_dvi_row_fifo_is_stale(uint32_t frame, uint32_t line);
 
 #ifdef __cplusplus
 } 
 #endif
-
@@ -0,0 +1,134 @@
+#include "hstx_dvi_span.h"
+
+#define PIXEL_BITS (0xffffffffu >> (32 - MODE_BITS_PER_PIXEL))
+// Most literal pixels a TMDS command can take in whole words
+#define LITERAL_MAX_COUNT ((HSTX_CMD_MAX_COUNT / HSTX_DVI_PIXELS_PER_WORD) * HSTX_DVI_PIXELS_PER_WORD)
+
+// Pixels are packed from the least significant end of the word. Screen
+// pixel q shows row pixel q >> h_shift.
+static __force_inline uint32_t enc_pixel_word(const hstx_dvi_pixel_t* p, const uint32_t q, const uint32_t h_shift) {
+	uint32_t w = 0;
+	for (uint32_t i = 0; i < HSTX_DVI_PIXELS_PER_WORD; ++i) {
+		w |= ((uint32_t)p[(q + i) >> h_shift] & PIXEL_BITS) << (i * MODE_BITS_PER_PIXEL);
+	}
+	return w;
+}
+
+static __force_inline uint32_t enc_solid_word(const hstx_dvi_pixel_t c) {
+	uint32_t w = c & PIXEL_BITS;
+	for (uint32_t i = MODE_BITS_PER_PIXEL; i < 32; i <<= 1) {
+		w |= w << i;
+	}
+	return w;
+}
+
+bool __not_in_flash_func(hstx_dvi_span_encode_repeat)(
+	hstx_dvi_span_row_t* r,
+	const hstx_dvi_span_t* spans,
+	const uint32_t n,
+	const uint32_t width,
+	const uint32_t h_repeat
+) {
+	const uint32_t h_shift = h_repeat == 4 ? 2 : h_repeat == 2 ? 1 : 0;
+	if (h_repeat != 1u << h_shift) return false;
+	uint32_t k = 0;
+	uint32_t pixels = 0;
+	for (uint32_t i = 0; i < n; ++i) {
+		const hstx_dvi_span_t* s = &spans[i];
+		// In screen pixels from here on
+		const uint32_t len = (uint32_t)s->len << h_shift;
+		if (!len) continue;
+		if (s->pixels) {
+			if (len % HSTX_DVI_PIXELS_PER_WORD) return false;
+			// Longer than a command can count, in whole words per command
+			for (uint32_t done = 0; done < len; ) {
+				uint32_t m = len - done;
+				if (m > LITERAL_MAX_COUNT) m = LITERAL_MAX_COUNT;
+				const uint32_t words = m / HSTX_DVI_PIXELS_PER_WORD;
+				if (k + 1 + words > HSTX_DVI_SPAN_ROW_WORDS) return false;
+				r->w[k++] = HSTX_CMD_TMDS | m;
+				for (uint32_t j = 0; j < words; ++j) {
+					r->w[k++] = enc_pixel_word(s->pixels, done + j * HSTX_DVI_PIXELS_PER_WORD, h_shift);
+				}
+				done += m;
+			}
+		}
+		else {
+			// The colour fills the whole word so it doesn't matter which
+			// part of it the encoder repeats
+			const uint32_t w = enc_solid_word(s->colour);
+			for (uint32_t done = 0; done < len; ) {
+				uint32_t m = len - done;
+				if (m > HSTX_CMD_MAX_COUNT) m = HSTX_CMD_MAX_COUNT;
+				if (k + 2 > HSTX_DVI_SPAN_ROW_WORDS) return false;
+				r->w[k++] = HSTX_CMD_TMDS_REPEAT | m;
+				r->w[k++] = w;
+				done += m;
+			}
+		}
+		pixels += len;
+	}
+	if (pixels != width << h_shift) return false;
+	// Pad to the FIFO depth, like the command lists in the core
+	while (k < HSTX_FIFO_WORDS) {
+		r->w[k++] = HSTX_CMD_NOP;
+	}
+	r->desc.w = r->w;
+	r->desc.words = k;
+	r->desc.kind = HSTX_DVI_ROW_KIND_CMDS;
+	r->desc.format = HSTX_DVI_FORMAT_DEFAULT;
+	return true;
+}
+
+bool __not_in_flash_func(hstx_dvi_span_encode)(
+	hstx_dvi_span_row_t* r,
+	const hstx_dvi_span_t* spans,
+	const uint32_t n,
+	const uint32_t width
+) {
+	return hstx_dvi_span_encode_repeat(r, spans, n, width, 1);
+}
+
+bool __not_in_flash_func(hstx_dvi_span_encode_solid)(
+	hstx_dvi_span_row_t* r,
+	const hstx_dvi_pixel_t colour,
+	const uint32_t width
+) {
+	const hstx_dvi_span_t s = { .len = width, .colour = colour, .pixels = 0 };
+	return hstx_dvi_span_encode(r, &s, 1, width);
+}
+
+uint32_t hstx_dvi_span_decode(
+	const hstx_dvi_span_row_t* r,
+	hstx_dvi_row_t* row,
+	const uint32_t width
+) {
+	uint32_t x = 0;
+	uint32_t k = 0;
+	while (k < r->desc.words) {
+		const uint32_t cmd = r->w[k++];
+		const uint32_t len = cmd & HSTX_CMD_MAX_COUNT;
+		switch (cmd & ~HSTX_CMD_MAX_COUNT) {
+			case HSTX_CMD_TMDS_REPEAT: {
+				const hstx_dvi_pixel_t c = (hstx_dvi_pixel_t)r->w[k++];
+				for (uint32_t i = 0; i < len; ++i, ++x) {
+					if (x < width) hstx_dvi_row_set_pixel(row, x, c);
+				}
+				break;
+			}
+			case HSTX_CMD_TMDS: {
+				for (uint32_t i = 0; i < len; ++i, ++x) {
+					const uint32_t j = i % HSTX_DVI_PIXELS_PER_WORD;
+					const uint32_t p = r->w[k] >> (j * MODE_BITS_PER_PIXEL);
+					if (x < width) hstx_dvi_row_set_pixel(row, x, (hstx_dvi_pixel_t)p);
+					if (j == HSTX_DVI_PIXELS_PER_WORD - 1) ++k;
+				}
+				break;
+			}
+			default:
+				// NOP padding
+				break;
+		}
+	}
+	return x;
+}
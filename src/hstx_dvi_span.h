@@ -0,0 +1,88 @@
+#pragma once
+
+#include "pico/stdlib.h"
+#include "hstx_dvi_core.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ----------------------------------------------------------------------------
+// Span encoded rows
+//
+// A row described as a short list of solid colour runs and literal pixel
+// chunks, encoded as HSTX TMDS_REPEAT/TMDS commands. The DMA then streams a
+// few command words instead of a whole row of pixels. A solid row costs 2
+// words (padded to the FIFO depth) instead of 160-320.
+// ----------------------------------------------------------------------------
+
+#ifndef HSTX_DVI_SPAN_ROW_WORDS
+#define HSTX_DVI_SPAN_ROW_WORDS 64
+#endif
+
+// Literal chunks must be a whole number of 32-bit words of pixels, see
+// HSTX_DVI_PIXELS_PER_WORD
+
+typedef struct {
+	uint16_t len;                   // Length in pixels
+	hstx_dvi_pixel_t colour;        // Colour of a solid run
+	const hstx_dvi_pixel_t* pixels; // Literal pixels, or NULL for a solid run
+} hstx_dvi_span_t;
+
+typedef struct {
+	hstx_dvi_row_desc_t desc;
+	uint32_t w[HSTX_DVI_SPAN_ROW_WORDS];
+} hstx_dvi_span_row_t;
+
+// Encode spans covering exactly width pixels. Spans are in screen pixels,
+// the core does not repeat them horizontally, so width is the mode's
+// h_active_pixels whatever hstx_dvi_set_repeat() was given. See
+// hstx_dvi_span_encode_repeat to have the commands repeat them. Spans longer
+// than HSTX_CMD_MAX_COUNT take more than one command. Returns false if they
+// don't cover width, if a literal chunk is not a whole number of words or if
+// the commands do not fit in the row.
+bool hstx_dvi_span_encode(
+	hstx_dvi_span_row_t* r,
+	const hstx_dvi_span_t* spans,
+	const uint32_t n,
+	const uint32_t width
+);
+
+// Encode spans covering exactly width row pixels, showing each pixel
+// h_repeat (1, 2 or 4) times across. This is how to repeat rows horizontally
+// for less DMA traffic than hstx_dvi_set_repeat() gives: a solid run is 2
+// words however long, and literal chunks are packed as full width pixels,
+// so a span row never costs more than a full width row. Literal chunks must
+// come to a whole number of words once repeated. Works at any bits per
+// pixel. Returns false as for hstx_dvi_span_encode, or for a bad h_repeat.
+bool hstx_dvi_span_encode_repeat(
+	hstx_dvi_span_row_t* r,
+	const hstx_dvi_span_t* spans,
+	const uint32_t n,
+	const uint32_t width,
+	const uint32_t h_repeat
+);
+
+// Encode a single solid colour run
+bool hstx_dvi_span_encode_solid(
+	hstx_dvi_span_row_t* r,
+	const hstx_dvi_pixel_t colour,
+	const uint32_t width
+);
+
+// Expand the commands back into pixels, at most width of them. Returns the
+// number of pixels the commands describe.
+uint32_t hstx_dvi_span_decode(
+	const hstx_dvi_span_row_t* r,
+	hstx_dvi_row_t* row,
+	const uint32_t width
+);
+
+// Reference to return from a row fetcher
+__force_inline hstx_dvi_row_t* hstx_dvi_span_row_ref(const hstx_dvi_span_row_t* r) {
+	return hstx_dvi_row_desc_ref(&r->desc);
+}
+
+#ifdef __cplusplus
+} 
+#endif
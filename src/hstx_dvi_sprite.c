@@ -1,42 +1,385 @@
 #include "hstx_dvi_sprite.h"
+#include "hstx_dvi_blit.h"
 #include "hstx_dvi_core.h"
 #include "hstx_dvi_row_fifo.h"
 #include "hstx_dvi_row_buf.h"
 #include "pico/sem.h" 
 #include "pico/multicore.h"
+#include "hardware/sync.h"
+#if HSTX_DVI_SPRITE_BUDGET
+#include "hardware/structs/systick.h"
+#endif
 #include <memory.h>
 
-Sprite _sprites[MAX_SPRITES];
-static Sprite _sprites_rdy[MAX_SPRITES];
+#if HSTX_DVI_SPRITE_CORES > 1 && HSTX_DVI_ROW_FIFO_LANES < 2
+#error "HSTX_DVI_SPRITE_CORES 2 needs HSTX_DVI_ROW_FIFO_LANES 2"
+#endif
+
+// Triple buffered sprite state, see SpriteState. The indexes and sequence
+// numbers of the front and published buffers only change under the lock.
+static SpriteState _states[3];
+SpriteState* _sprite_state;
+static const SpriteState* _front_state;
+static spin_lock_t* _state_lock;
+static uint32_t _front;
+static uint32_t _ready;
+static uint32_t _back;
+static volatile uint32_t _front_seq;
+static uint32_t _ready_seq;
+// Game core only, with the sequence number of the state in each buffer
+static uint32_t _published_seq;
+static uint32_t _state_seq[3];
+uint32_t _sprite_back_seq;
+uint32_t _sprite_changed_seq[MAX_SPRITES + 1];
+
+// Tile rows for a line, one tile wider than the screen for the fine scroll
+#define SPRITE_BG_TILES (((MODE_H_ACTIVE_PIXELS + 7) >> 3) + 1)
+#define SPRITE_BG_LINE_WORDS (((SPRITE_BG_TILES * SPRITE_BG_TILE_ROW_BYTES + 3) >> 2) + 1)
+typedef union {
+	uint8_t b[SPRITE_BG_LINE_WORDS << 2];
+	uint32_t w[SPRITE_BG_LINE_WORDS];
+} SpriteBgLine;
+static SpriteBgLine _bgLine[HSTX_DVI_SPRITE_CORES];
+// Where the background has its transparent colour on the line, a bit per
+// pixel like the occupancy bitmap
+static uint32_t _bgClear[HSTX_DVI_SPRITE_CORES][SPRITE_OCC_ROW_WORDS];
+// What the layer being drawn is clipped to, or null
+static const uint32_t* _clip[HSTX_DVI_SPRITE_CORES];
 
 static SpriteCollisionMask _spriteCollisionMasks[MAX_SPRITES];
-static SpriteIdRow _spriteIdRow; 
+// Each rendering core has its own id row (or bitmap) and collisions for the
+// frame
+#if HSTX_DVI_SPRITE_COLLISION_BITMAP
+static SpriteOccupancyRow _spriteOccRow[HSTX_DVI_SPRITE_CORES];
+#else
+static SpriteIdRow _spriteIdRow[HSTX_DVI_SPRITE_CORES]; 
+#endif
 SpriteCollisions _spriteCollisions;
-static SpriteCollisions _spriteCollisionsFrame;
+static SpriteCollisions _spriteCollisionsFrame[HSTX_DVI_SPRITE_CORES];
 static struct semaphore _frame_sem;
 
+#define SPRITE_BAND_LINES (1 << HSTX_DVI_SPRITE_BAND_SHIFT)
+#define SPRITE_BANDS ((MODE_V_ACTIVE_LINES + SPRITE_BAND_LINES - 1) >> HSTX_DVI_SPRITE_BAND_SHIFT)
+#define SPRITE_BAND_LISTS (SPRITE_BANDS * SPRITE_LAYERS)
+
+// The sprites whose top line is in each band, by layer and in sprite order.
+// A sprite is listed once however many bands it covers.
+static uint16_t _band_start[SPRITE_BAND_LISTS + 1];
+static uint16_t _band_next[SPRITE_BAND_LISTS];
+static SpriteId _band_sprites[MAX_SPRITES];
+
+// The sprites on the lines a core is walking down the frame, by layer and
+// in sprite order. A sprite joins as the core gets to the band its top line
+// is in, and leaves once the core is past its bottom line, so a line only
+// looks at the sprites on it and the few about to start.
+typedef struct {
+	uint32_t frame;
+	uint32_t line;
+	uint32_t band;                          // next band to join
+	uint16_t n[SPRITE_LAYERS];
+	SpriteId s[SPRITE_LAYERS][MAX_SPRITES];
+} SpriteEdges;
+static SpriteEdges _edges[HSTX_DVI_SPRITE_CORES];
+
+#if HSTX_DVI_SPRITE_BUDGET
+static volatile uint32_t _line_budget = HSTX_DVI_SPRITE_LINE_BUDGET;
+// Each rendering core's figures for the frame, and whether the line it is
+// on has been cut short
+static SpriteBudgetStats _budgetFrame[HSTX_DVI_SPRITE_CORES];
+static bool _budgetCut[HSTX_DVI_SPRITE_CORES];
+// The last complete frame, published like the core statistics
+static SpriteBudgetStats _budgetStats;
+static volatile uint32_t _budgetSeq;
+static uint32_t _budgetTotalCut;
+#endif
+
+#if HSTX_DVI_SPRITE_CORES > 1
+// Core 0 asks to join a frame, core 1 lets it go once the sprites are
+// copied and core 0 says when it has finished its last line
+static struct semaphore _join_sem;
+static struct semaphore _go_sem;
+static struct semaphore _done_sem;
+// The frame being rendered and the next line to take from it
+static spin_lock_t* _line_lock;
+static volatile uint32_t _render_frame;
+static volatile uint32_t _next_line;
+#endif
+
+static __force_inline uint32_t render_core() {
+#if HSTX_DVI_SPRITE_CORES > 1
+	return get_core_num();
+#else
+	return 0;
+#endif
+}
+
 __force_inline void clear_sprite_collisions(SpriteCollisions* sc) {
 	for(uint32_t i = 0; i < MAX_SPRITES; ++i) sc->m[i] = 0;
 }
 
+// Publish the collisions from the last frame and start on the next one
+static void __not_in_flash_func(swap_sprite_collisions)() {
+	memcpy(&_spriteCollisions, &_spriteCollisionsFrame[0], sizeof(_spriteCollisions));
+	clear_sprite_collisions(&_spriteCollisionsFrame[0]);
+	for (uint32_t c = 1; c < HSTX_DVI_SPRITE_CORES; ++c) {
+		for (uint32_t i = 0; i < MAX_SPRITES; ++i) _spriteCollisions.m[i] |= _spriteCollisionsFrame[c].m[i];
+		clear_sprite_collisions(&_spriteCollisionsFrame[c]);
+	}
+}
+
+// The band a sprite's top line is in, false if it is disabled or off screen
+static __force_inline bool sprite_band(const Sprite* sprite, uint32_t* b) {
+	if (!(sprite->f & SF_ENABLE)) return false;
+	const int32_t top = sprite->y < 0 ? 0 : sprite->y;
+	const int32_t bottom = sprite->y + (int32_t)(sprite->h << hstx_dvi_sprite_get_zoom(sprite));
+	if (top >= bottom || top >= MODE_V_ACTIVE_LINES) return false;
+	*b = (uint32_t)top >> HSTX_DVI_SPRITE_BAND_SHIFT;
+	return true;
+}
+
+// Sort the ready sprites by the band they start in and layer, once per new
+// state
+static void __not_in_flash_func(bucket_sprites)() {
+	uint32_t b;
+	const Sprite* const sprites = _front_state->sprites;
+	for (uint32_t i = 0; i <= SPRITE_BAND_LISTS; ++i) _band_start[i] = 0;
+	for (uint32_t i = 0; i < MAX_SPRITES; ++i) {
+		if (sprite_band(&sprites[i], &b)) {
+			_band_start[b * SPRITE_LAYERS + hstx_dvi_sprite_get_layer(&sprites[i]) + 1]++;
+		}
+	}
+	for (uint32_t i = 0; i < SPRITE_BAND_LISTS; ++i) _band_start[i + 1] += _band_start[i];
+	// Fill in sprite order, so each list keeps the sprite priority
+	memcpy(_band_next, _band_start, sizeof(_band_next));
+	for (uint32_t i = 0; i < MAX_SPRITES; ++i) {
+		if (sprite_band(&sprites[i], &b)) {
+			_band_sprites[_band_next[b * SPRITE_LAYERS + hstx_dvi_sprite_get_layer(&sprites[i])]++] = i;
+		}
+	}
+	// Every core starts its walk again on the new sprites
+	for (uint32_t c = 0; c < HSTX_DVI_SPRITE_CORES; ++c) _edges[c].line = UINT32_MAX;
+}
+
+// Merge the sprites starting in a band into a layer's list. Both are in
+// sprite order, so merge from the back.
+static __force_inline void join_edges(SpriteId* s, uint16_t* n, const SpriteId* add, const uint32_t k) {
+	uint32_t i = *n;
+	uint32_t j = k;
+	uint32_t o = i + k;
+	while (j) {
+		if (i && s[i - 1] > add[j - 1]) s[--o] = s[--i];
+		else s[--o] = add[--j];
+	}
+	*n = (uint16_t)(*n + k);
+}
+
+// Bring the calling core's lists down to line y. A new frame, or a line
+// further up, starts them again.
+static __force_inline SpriteEdges* walk_edges(const uint32_t frame_index, const uint32_t y) {
+	SpriteEdges* const e = &_edges[render_core()];
+	if (e->frame != frame_index || y < e->line) {
+		for (uint32_t l = 0; l < SPRITE_LAYERS; ++l) e->n[l] = 0;
+		e->frame = frame_index;
+		e->band = 0;
+	}
+	e->line = y;
+	for (const uint32_t b = y >> HSTX_DVI_SPRITE_BAND_SHIFT; e->band <= b; ++e->band) {
+		const uint16_t* const bs = &_band_start[e->band * SPRITE_LAYERS];
+		for (uint32_t l = 0; l < SPRITE_LAYERS; ++l) {
+			if (bs[l + 1] > bs[l]) join_edges(e->s[l], &e->n[l], &_band_sprites[bs[l]], bs[l + 1] - bs[l]);
+		}
+	}
+	return e;
+}
+
+uint32_t __not_in_flash_func(hstx_dvi_sprite_publish)() {
+	const uint32_t seq = ++_published_seq;
+	const uint32_t save = spin_lock_blocking(_state_lock);
+	const uint32_t back = _back;
+	_back = _ready;
+	_ready = back;
+	_ready_seq = seq;
+	spin_unlock(_state_lock, save);
+	_state_seq[back] = seq;
+	// The game core carries on from what it just published. The new back
+	// buffer holds an older state, so copy in what changed since then.
+	const SpriteState* const from = &_states[back];
+	SpriteState* const to = &_states[_back];
+	const uint32_t held = _state_seq[_back];
+	for (uint32_t i = 0; i < MAX_SPRITES; ++i) {
+		if ((int32_t)(_sprite_changed_seq[i] - held) > 0) to->sprites[i] = from->sprites[i];
+	}
+	if ((int32_t)(_sprite_changed_seq[MAX_SPRITES] - held) > 0) to->background = from->background;
+	_state_seq[_back] = seq;
+	_sprite_state = to;
+	_sprite_back_seq = seq + 1;
+	return seq;
+}
+
+uint32_t hstx_dvi_sprite_get_shown_seq() {
+	return _front_seq;
+}
+
+// Swap in the latest state the game core has published, if there is one.
+// After a swap the published buffer holds the older state, which mustn't
+// be swapped back, so only take it when its sequence is newer.
+static void __not_in_flash_func(take_sprites)() {
+	const uint32_t save = spin_lock_blocking(_state_lock);
+	const bool taken = (int32_t)(_ready_seq - _front_seq) > 0;
+	if (taken) {
+		const uint32_t front = _front;
+		const uint32_t seq = _front_seq;
+		_front = _ready;
+		_front_seq = _ready_seq;
+		_ready = front;
+		_ready_seq = seq;
+	}
+	spin_unlock(_state_lock, save);
+	if (taken) {
+		_front_state = &_states[_front];
+		bucket_sprites();
+	}
+}
+
+#if HSTX_DVI_SPRITE_BUDGET
+static void budget_reset(const uint32_t core) {
+	memset(&_budgetFrame[core], 0, sizeof(_budgetFrame[core]));
+	_budgetFrame[core].first_cut_line = HSTX_DVI_STATS_NONE;
+}
+
+// SysTick free runs on the processor clock of each core, as for the core
+// statistics
+static void budget_init_core() {
+	systick_hw->rvr = 0x00ffffff;
+	systick_hw->cvr = 0;
+	systick_hw->csr = 0x5;
+}
+
+static __force_inline uint32_t budget_cycles() {
+	return systick_hw->cvr;
+}
+
+static __force_inline uint32_t budget_elapsed(const uint32_t start) {
+	// SysTick counts down
+	return (start - budget_cycles()) & 0x00ffffff;
+}
+
+// Combine the cores' figures at the end of a frame and publish them
+static void __not_in_flash_func(budget_publish)(const uint32_t frame_index) {
+	SpriteBudgetStats f = _budgetFrame[0];
+	for (uint32_t c = 1; c < HSTX_DVI_SPRITE_CORES; ++c) {
+		const SpriteBudgetStats* const o = &_budgetFrame[c];
+		f.lines_cut += o->lines_cut;
+		if (o->first_cut_line < f.first_cut_line) f.first_cut_line = o->first_cut_line;
+		f.sprites_skipped += o->sprites_skipped;
+		if (o->line_cycles_max > f.line_cycles_max) f.line_cycles_max = o->line_cycles_max;
+		f.line_cycles_total += o->line_cycles_total;
+	}
+	_budgetTotalCut += f.lines_cut;
+	f.frame = frame_index;
+	f.total_lines_cut = _budgetTotalCut;
+	++_budgetSeq;
+	__dmb();
+	_budgetStats = f;
+	__dmb();
+	++_budgetSeq;
+	for (uint32_t c = 0; c < HSTX_DVI_SPRITE_CORES; ++c) budget_reset(c);
+}
+
+void hstx_dvi_sprite_set_line_budget(uint32_t cycles) {
+	_line_budget = cycles;
+}
+
+bool hstx_dvi_sprite_get_budget_stats(SpriteBudgetStats* stats) {
+	uint32_t seq;
+	do {
+		seq = _budgetSeq;
+		__dmb();
+		*stats = _budgetStats;
+		__dmb();
+	} while ((seq & 1) || seq != _budgetSeq);
+	return true;
+}
+#else
+void hstx_dvi_sprite_set_line_budget(uint32_t cycles) {
+	(void)cycles;
+}
+
+bool hstx_dvi_sprite_get_budget_stats(SpriteBudgetStats* stats) {
+	(void)stats;
+	return false;
+}
+#endif
+
+#if HSTX_DVI_SPRITE_CORES > 1
+// The next line of the frame for either core to render
+static __force_inline uint32_t take_line() {
+	const uint32_t save = spin_lock_blocking(_line_lock);
+	const uint32_t y = _next_line;
+	if (y < MODE_V_ACTIVE_LINES) _next_line = y + 1;
+	spin_unlock(_line_lock, save);
+	return y;
+}
+
+static void __not_in_flash_func(render_lines)(const uint32_t frame_index) {
+	for (uint32_t y = take_line(); y < MODE_V_ACTIVE_LINES; y = take_line()) {
+		hstx_dvi_sprite_render_line(frame_index, y);
+	}
+}
+#endif
+
 void __not_in_flash_func(hstx_dvi_sprite_render_loop)() {
 
     hstx_dvi_init(hstx_dvi_row_fifo_get_row_fetcher());
+#if HSTX_DVI_SPRITE_BUDGET
+	budget_init_core();
+#endif
 
-    for(uint32_t frame_index = 0; true; ++frame_index) {
+    // Start on the frame the scan-out will fetch next
+    uint32_t frame_index, line;
+    hstx_dvi_row_fifo_get_expected(&frame_index, &line);
+    for(; true; ++frame_index) {
+#if HSTX_DVI_SPRITE_CORES > 1
+		// If the other core is waiting, it gets the new sprites and helps
+		// with the frame
+		const bool joined = sem_try_acquire(&_join_sem);
+		take_sprites();
+		if (joined) swap_sprite_collisions();
+		_render_frame = frame_index;
+		_next_line = 0;
+		if (joined) sem_release(&_go_sem);
+		render_lines(frame_index);
+		if (joined) sem_acquire_blocking(&_done_sem);
+#if HSTX_DVI_SPRITE_BUDGET
+		budget_publish(frame_index);
+#endif
+#else
+		take_sprites();
         hstx_dvi_sprite_render_frame(frame_index);
+#if HSTX_DVI_SPRITE_BUDGET
+		budget_publish(frame_index);
+#endif
 		// If the other core is waiting for the next frame
 		if(!sem_available(&_frame_sem)) {
-			memcpy(_sprites_rdy, _sprites, sizeof(_sprites));
-			memcpy(&_spriteCollisions, &_spriteCollisionsFrame, sizeof(_spriteCollisionsFrame));
-			clear_sprite_collisions(&_spriteCollisionsFrame);
+			swap_sprite_collisions();
 		}
         sem_release(&_frame_sem);
+#endif
     }
 }
 
 void __not_in_flash_func(hstx_dvi_sprite_wait_for_frame)(){
+#if HSTX_DVI_SPRITE_CORES > 1
+	hstx_dvi_sprite_publish();
+	// Render lines of the next frame alongside core 1
+	sem_release(&_join_sem);
+	sem_acquire_blocking(&_go_sem);
+	render_lines(_render_frame);
+	sem_release(&_done_sem);
+#else
+	hstx_dvi_sprite_publish();
     sem_acquire_blocking(&_frame_sem);
+#endif
 }
 
 void hstx_dvi_sprite_set_sprite_collision_mask(
@@ -52,18 +395,42 @@ void __not_in_flash_func(hstx_dvi_sprite_init_all)() {
     // Initialize the row buffer
     hstx_dvi_row_buf_init();
 	// Clear down the sprites	
-	for(uint32_t i = 0; i < MAX_SPRITES; ++i) {
-		_sprites[i].f = 0;
-		_sprites_rdy[i].f = 0;
+	for (uint32_t b = 0; b < 3; ++b) {
+		for(uint32_t i = 0; i < MAX_SPRITES; ++i) _states[b].sprites[i].f = 0;
+		_states[b].background.tiles = 0;
 	}
+	_front = 0;
+	_ready = 1;
+	_back = 2;
+	_front_seq = 0;
+	_ready_seq = 0;
+	_published_seq = 0;
+	for (uint32_t b = 0; b < 3; ++b) _state_seq[b] = 0;
+	for (uint32_t i = 0; i <= MAX_SPRITES; ++i) _sprite_changed_seq[i] = 0;
+	_sprite_back_seq = 1;
+	_front_state = &_states[_front];
+	_sprite_state = &_states[_back];
+	_state_lock = spin_lock_init(spin_lock_claim_unused(true));
+	bucket_sprites();
 	// Set up the frame semaphore. Released at the end of every frame.
     sem_init(&_frame_sem, 0, 1);
+#if HSTX_DVI_SPRITE_CORES > 1
+	sem_init(&_join_sem, 0, 1);
+	sem_init(&_go_sem, 0, 1);
+	sem_init(&_done_sem, 0, 1);
+	_line_lock = spin_lock_init(spin_lock_claim_unused(true));
+#endif
+#if HSTX_DVI_SPRITE_BUDGET
+	// Core 0 times the lines it renders too
+	if (HSTX_DVI_SPRITE_CORES > 1) budget_init_core();
+	for (uint32_t c = 0; c < HSTX_DVI_SPRITE_CORES; ++c) budget_reset(c);
+#endif
 
     // Initialize the HSTX DVI row FIFO.
-    hstx_dvi_row_fifo_init1(pio0);
+    hstx_dvi_row_fifo_init();
 
 	// Clear down any collision flags
-	clear_sprite_collisions(&_spriteCollisionsFrame);
+	for (uint32_t c = 0; c < HSTX_DVI_SPRITE_CORES; ++c) clear_sprite_collisions(&_spriteCollisionsFrame[c]);
 	clear_sprite_collisions(&_spriteCollisions);
 
 	// Start the renderer
@@ -71,7 +438,14 @@ void __not_in_flash_func(hstx_dvi_sprite_init_all)() {
 }
 
 void __not_in_flash_func(clear_sprite_id_row)() {
-	for(uint32_t i = 0; i < SPRITE_ID_ROW_WORDS; ++i) _spriteIdRow.word[i] = 0;
+#if HSTX_DVI_SPRITE_COLLISION_BITMAP
+	SpriteOccupancyRow* const occRow = &_spriteOccRow[render_core()];
+	for(uint32_t i = 0; i < SPRITE_OCC_ROW_WORDS; ++i) occRow->occ[i] = 0;
+	occRow->n = 0;
+#else
+	SpriteIdRow* const idRow = &_spriteIdRow[render_core()];
+	for(uint32_t i = 0; i < SPRITE_ID_ROW_WORDS; ++i) idRow->word[i] = 0;
+#endif
 }
 
 void __not_in_flash_func(render_row_mono)(
@@ -81,25 +455,29 @@ void __not_in_flash_func(render_row_mono)(
     hstx_dvi_fill_row(r, p);
 }
 
+#if !HSTX_DVI_SPRITE_COLLISION_BITMAP
 static __force_inline void render_sprite_pixel(
 	hstx_dvi_row_t* r,
     hstx_dvi_pixel_t p,
 	const SpriteId spriteId,
 	const uint32_t j)
 {
-	const SpriteId ncid = _spriteIdRow.id[j];
+	SpriteIdRow* const idRow = &_spriteIdRow[render_core()];
+	SpriteCollisions* const frameCollisions = &_spriteCollisionsFrame[render_core()];
+	const SpriteId ncid = idRow->id[j];
 	if (ncid)
 	{
 		const SpriteId cid = ncid - 1;
-		_spriteCollisionsFrame.m[cid] |= _spriteCollisionMasks[spriteId];
-		_spriteCollisionsFrame.m[spriteId] |= _spriteCollisionMasks[cid];
+		frameCollisions->m[cid] |= _spriteCollisionMasks[spriteId];
+		frameCollisions->m[spriteId] |= _spriteCollisionMasks[cid];
 	}
 	else
 	{
         hstx_dvi_row_set_pixel(r, j, p);
-		_spriteIdRow.id[j] = spriteId + 1;
+		idRow->id[j] = spriteId + 1;
 	}
 }
+#endif
 
 static __force_inline void render_pixel(
 	hstx_dvi_row_t* r,
@@ -109,19 +487,68 @@ static __force_inline void render_pixel(
     hstx_dvi_row_set_pixel(r, j, p);
 }
 
-static __force_inline void render_sprite_row_n_p1(
+// Drop the pixels of a sprite row the layer can't show
+static __force_inline uint32_t clip_row(
 	const uint32_t d,
+	const int32_t x,
+	const uint32_t w
+) {
+	const uint32_t* const c = _clip[render_core()];
+	if (!c) return d;
+	const int32_t i0 = x >> 5;
+	const uint32_t hi = (uint32_t)i0 < SPRITE_OCC_ROW_WORDS ? c[i0] : 0;
+	const uint32_t lo = (uint32_t)(i0 + 1) < SPRITE_OCC_ROW_WORDS ? c[i0 + 1] : 0;
+	const uint64_t win = ((((uint64_t)hi) << 32) | lo) << ((uint32_t)x & 31);
+	return d & (uint32_t)(win >> (64 - w));
+}
+
+static __force_inline void blit_sprite_row_p1(
+	const uint32_t dm,
 	const hstx_dvi_pixel_t* p1,
 	hstx_dvi_row_t* r,
 	const int32_t x,
 	const SpriteId spriteId,
 	const uint32_t w
 ) {
+	const uint32_t d = clip_row(dm, x, w);
+#if HSTX_DVI_SPRITE_COLLISION_BITMAP
 	if (d)
 	{
+		hstx_dvi_blit_sprite_row_bitmap(
+			d,
+			w,
+			p1[0],
+			r,
+			x,
+			spriteId,
+			&_spriteOccRow[render_core()],
+			&_spriteCollisionsFrame[render_core()],
+			_spriteCollisionMasks
+		);
+	}
+#elif MODE_BITS_PER_PIXEL >= 8
+	if (d)
+	{
+		hstx_dvi_blit_sprite_row(
+			d,
+			w,
+			p1[0],
+			r,
+			x,
+			spriteId,
+			&_spriteIdRow[render_core()],
+			&_spriteCollisionsFrame[render_core()],
+			_spriteCollisionMasks
+		);
+	}
+#else
+	if (d)
+	{
+		SpriteIdRow* const idRow = &_spriteIdRow[render_core()];
+		SpriteCollisions* const frameCollisions = &_spriteCollisionsFrame[render_core()];
 		const SpriteCollisionMask spriteCollisionMask = _spriteCollisionMasks[spriteId];
-		SpriteCollisionMask* const spriteCollisionsPtr = &_spriteCollisionsFrame.m[spriteId];
-		const uint32_t bm = 1 << (w-1);
+		SpriteCollisionMask* const spriteCollisionsPtr = &frameCollisions->m[spriteId];
+		const uint32_t bm = 1u << (w-1);
         const hstx_dvi_pixel_t p = p1[0];
 		const uint32_t ux = (uint32_t)x;
 		if (ux < (MODE_H_ACTIVE_PIXELS - w))
@@ -131,17 +558,17 @@ static __force_inline void render_sprite_row_n_p1(
 				const uint32_t j = ux + i;
 				if (d & (bm >> i))
 				{
-					const SpriteId ncid = _spriteIdRow.id[j];
+					const SpriteId ncid = idRow->id[j];
 					if (ncid)
 					{
 						const SpriteId cid = ncid - 1;
-						_spriteCollisionsFrame.m[cid] |= spriteCollisionMask;
+						frameCollisions->m[cid] |= spriteCollisionMask;
 						*spriteCollisionsPtr |= _spriteCollisionMasks[cid];
 					}
 					else
 					{
 						hstx_dvi_row_set_pixel(r, j, p);
-						_spriteIdRow.id[j] = spriteId + 1;
+						idRow->id[j] = spriteId + 1;
 					}
 				}
 			}
@@ -153,35 +580,298 @@ static __force_inline void render_sprite_row_n_p1(
 				const uint32_t j = ux + i;
 				if ((j < MODE_H_ACTIVE_PIXELS) && (d & (bm >> i)))
 				{
-					const SpriteId ncid = _spriteIdRow.id[j];
+					const SpriteId ncid = idRow->id[j];
 					if (ncid)
 					{
 						const SpriteId cid = ncid - 1;
-						_spriteCollisionsFrame.m[cid] |= spriteCollisionMask;
+						frameCollisions->m[cid] |= spriteCollisionMask;
 						*spriteCollisionsPtr |= _spriteCollisionMasks[cid];
 					}
 					else
 					{
 						hstx_dvi_row_set_pixel(r, j, p);
-						_spriteIdRow.id[j] = spriteId + 1;
+						idRow->id[j] = spriteId + 1;
 					}
 				}
 			}
 		}
 	}
+#endif
 }
 
-static __force_inline void render_row_n_p1(
+// Mirror and zoom a sprite row, blitting the zoomed row 32 pixels at a time
+static void __not_in_flash_func(render_sprite_row_n_p1_xform)(
+	uint32_t d,
+	const hstx_dvi_pixel_t* p1,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const SpriteId spriteId,
+	const uint32_t w,
+	const Sprite* sprite
+) {
+	if (sprite->f & SF_HFLIP) d = hstx_dvi_blit_flip(d, w);
+	const uint32_t z = hstx_dvi_sprite_get_zoom(sprite);
+	if (!z) {
+		blit_sprite_row_p1(d, p1, r, x, spriteId, w);
+		return;
+	}
+	const uint32_t zw = w << z;
+	uint32_t s = d << (32 - w);
+	for (uint32_t k = 0; k < zw; k += 32, s <<= 32 >> z) {
+		const uint32_t n = zw - k < 32 ? zw - k : 32;
+		blit_sprite_row_p1(hstx_dvi_blit_zoom(s, z) >> (32 - n), p1, r, x + (int32_t)k, spriteId, n);
+	}
+}
+
+static __force_inline void render_sprite_row_n_p1(
 	const uint32_t d,
 	const hstx_dvi_pixel_t* p1,
 	hstx_dvi_row_t* r,
 	const int32_t x,
+	const SpriteId spriteId,
+	const uint32_t w
+) {
+	const Sprite* const sprite = &_front_state->sprites[spriteId];
+	if (sprite->f & (SF_HFLIP | SF_ZOOM_MASK)) {
+		render_sprite_row_n_p1_xform(d, p1, r, x, spriteId, w, sprite);
+	}
+	else {
+		blit_sprite_row_p1(d, p1, r, x, spriteId, w);
+	}
+}
+
+// Draw the pixels set in d (w bits, first pixel in bit w-1) in the colours
+// from c, with the same collisions as render_sprite_row_n_p1
+static __force_inline void render_sprite_row_n_c(
+	const uint32_t dm,
+	const hstx_dvi_blit_colours_t* const c,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const SpriteId spriteId,
+	const uint32_t w
+) {
+	const uint32_t d = clip_row(dm, x, w);
+	if (!d) return;
+#if HSTX_DVI_SPRITE_COLLISION_BITMAP
+	hstx_dvi_blit_sprite_row_bitmap_c(
+		d,
+		w,
+		0,
+		c,
+		r,
+		x,
+		spriteId,
+		&_spriteOccRow[render_core()],
+		&_spriteCollisionsFrame[render_core()],
+		_spriteCollisionMasks
+	);
+#elif MODE_BITS_PER_PIXEL >= 8
+	hstx_dvi_blit_sprite_row_c(
+		d,
+		w,
+		0,
+		c,
+		r,
+		x,
+		spriteId,
+		&_spriteIdRow[render_core()],
+		&_spriteCollisionsFrame[render_core()],
+		_spriteCollisionMasks
+	);
+#else
+	SpriteIdRow* const idRow = &_spriteIdRow[render_core()];
+	SpriteCollisions* const frameCollisions = &_spriteCollisionsFrame[render_core()];
+	const uint32_t bm = 1u << (w-1);
+	const uint32_t o = (uint32_t)x & 31;
+	for (uint32_t i = 0; i < w; i++)
+	{
+		const uint32_t j = (uint32_t)x + i;
+		if ((j < MODE_H_ACTIVE_PIXELS) && (d & (bm >> i)))
+		{
+			const SpriteId ncid = idRow->id[j];
+			if (ncid)
+			{
+				const SpriteId cid = ncid - 1;
+				frameCollisions->m[cid] |= _spriteCollisionMasks[spriteId];
+				frameCollisions->m[spriteId] |= _spriteCollisionMasks[cid];
+			}
+			else
+			{
+				hstx_dvi_row_set_pixel(r, j, c->p[o + i]);
+				idRow->id[j] = spriteId + 1;
+			}
+		}
+	}
+#endif
+}
+
+// Look up a row of w paletted pixels of bpp bits, packed first pixel in the
+// top bits of each word of dd, into c. Returns the mask of the pixels that
+// are not colour 0, which is transparent.
+static __force_inline uint32_t palette_row(
+	const uint32_t* dd,
+	const uint32_t bpp,
+	const uint32_t w,
+	const hstx_dvi_pixel_t* pal,
+	const int32_t x,
+	hstx_dvi_blit_colours_t* c
+) {
+	const uint32_t ppw = 32 / bpp;
+	const uint32_t o = (uint32_t)x & 31;
+	uint32_t d = 0;
+	for (uint32_t k = 0; k < w; k += ppw) {
+		const uint32_t n = w - k < ppw ? w - k : ppw;
+		uint32_t v = dd[k / ppw];
+		if (!v) {
+			d <<= n;
+			continue;
+		}
+		for (uint32_t i = 0; i < n; ++i, v <<= bpp) {
+			const uint32_t pi = v >> (32 - bpp);
+			d <<= 1;
+			if (pi) {
+				d |= 1;
+				c->p[o + k + i] = pal[pi];
+			}
+		}
+	}
+	return d;
+}
+
+// As palette_row, for w direct colour pixels with a transparent key colour
+static __force_inline uint32_t direct_row(
+	const hstx_dvi_pixel_t* dd,
+	const uint32_t w,
+	const hstx_dvi_pixel_t key,
+	const int32_t x,
+	hstx_dvi_blit_colours_t* c
+) {
+	const uint32_t o = (uint32_t)x & 31;
+	uint32_t d = 0;
+	for (uint32_t i = 0; i < w; ++i) {
+		const hstx_dvi_pixel_t p = dd[i];
+		d <<= 1;
+		if (p != key) {
+			d |= 1;
+			c->p[o + i] = p;
+		}
+	}
+	return d;
+}
+
+// Source pixel i of a paletted row of bpp bits, or of a direct colour row
+// when bpp is 0. Returns false for a transparent pixel.
+static __force_inline bool source_pixel(
+	const void* dd,
+	const uint32_t bpp,
+	const uint32_t i,
+	const hstx_dvi_pixel_t* pal,
+	const hstx_dvi_pixel_t key,
+	hstx_dvi_pixel_t* p
+) {
+	if (bpp) {
+		const uint32_t ppw = 32 / bpp;
+		const uint32_t pi = (((const uint32_t*)dd)[i / ppw] << ((i % ppw) * bpp)) >> (32 - bpp);
+		*p = pal[pi];
+		return pi != 0;
+	}
+	*p = ((const hstx_dvi_pixel_t*)dd)[i];
+	return *p != key;
+}
+
+// Mirror and zoom a multi-colour sprite row. Each 32 pixels of the zoomed
+// row are expanded into the colour buffer, every source pixel written 1, 2
+// or 4 times, and then blitted.
+static void __not_in_flash_func(render_sprite_row_n_xform_c)(
+	const void* dd,
+	const uint32_t bpp,
+	const hstx_dvi_pixel_t* pal,
+	const hstx_dvi_pixel_t key,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const SpriteId spriteId,
+	const uint32_t w,
+	const Sprite* sprite
+) {
+	const bool flip = sprite->f & SF_HFLIP;
+	const uint32_t z = hstx_dvi_sprite_get_zoom(sprite);
+	const uint32_t zn = 1 << z;
+	const uint32_t zm = (1 << zn) - 1;
+	const uint32_t zw = w << z;
+	hstx_dvi_blit_colours_t c;
+	for (uint32_t k = 0; k < zw; k += 32) {
+		const uint32_t n = zw - k < 32 ? zw - k : 32;
+		const int32_t xk = x + (int32_t)k;
+		hstx_dvi_pixel_t* const cp = &c.p[(uint32_t)xk & 31];
+		uint32_t d = 0;
+		for (uint32_t j = 0; j < n; j += zn) {
+			const uint32_t i = (k + j) >> z;
+			hstx_dvi_pixel_t p;
+			d <<= zn;
+			if (source_pixel(dd, bpp, flip ? w - 1 - i : i, pal, key, &p)) {
+				d |= zm;
+				for (uint32_t q = 0; q < zn; ++q) cp[j + q] = p;
+			}
+		}
+		render_sprite_row_n_c(d, &c, r, xk, spriteId, n);
+	}
+}
+
+static __force_inline void render_sprite_row_n_pal(
+	const uint32_t* dd,
+	const uint32_t bpp,
+	const hstx_dvi_pixel_t* pal,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const SpriteId spriteId,
+	const uint32_t w
+) {
+	const Sprite* const sprite = &_front_state->sprites[spriteId];
+	if (sprite->f & (SF_HFLIP | SF_ZOOM_MASK)) {
+		render_sprite_row_n_xform_c(dd, bpp, pal, 0, r, x, spriteId, w, sprite);
+		return;
+	}
+	hstx_dvi_blit_colours_t c;
+	const uint32_t d = palette_row(dd, bpp, w, pal, x, &c);
+	render_sprite_row_n_c(d, &c, r, x, spriteId, w);
+}
+
+static __force_inline void render_sprite_row_n_direct(
+	const hstx_dvi_pixel_t* dd,
+	const hstx_dvi_pixel_t key,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const SpriteId spriteId,
+	const uint32_t w
+) {
+	const Sprite* const sprite = &_front_state->sprites[spriteId];
+	if (sprite->f & (SF_HFLIP | SF_ZOOM_MASK)) {
+		render_sprite_row_n_xform_c(dd, 0, 0, key, r, x, spriteId, w, sprite);
+		return;
+	}
+	hstx_dvi_blit_colours_t c;
+	const uint32_t d = direct_row(dd, w, key, x, &c);
+	render_sprite_row_n_c(d, &c, r, x, spriteId, w);
+}
+
+static __force_inline void render_row_n_p1(
+	const uint32_t dm,
+	const hstx_dvi_pixel_t* p1,
+	hstx_dvi_row_t* r,
+	const int32_t x,
 	const uint32_t w
 ) {
+	const uint32_t d = clip_row(dm, x, w);
+#if MODE_BITS_PER_PIXEL >= 8
+	if (d)
+	{
+		hstx_dvi_blit_row(d, w, p1[0], r, x);
+	}
+#else
 	if (d)
 	{
         const hstx_dvi_pixel_t p = p1[0];
-		const uint32_t bm = 1 << (w-1);
+		const uint32_t bm = 1u << (w-1);
 		if (((uint32_t)x) < (MODE_H_ACTIVE_PIXELS - w))
 		{
 			for (int32_t i = 0; i < w; i++)
@@ -205,6 +895,7 @@ static __force_inline void render_row_n_p1(
 			}
 		}
 	}
+#endif
 }
 
 static __force_inline void render_row_text_8_p1(
@@ -396,6 +1087,156 @@ void __not_in_flash_func(sprite_renderer_sprite_32x16_p1)(
 	);
 }
 
+void __not_in_flash_func(sprite_renderer_sprite_8x8_p4)(
+	const void* d1,
+	const void* d2,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const int32_t row,
+	const SpriteId spriteId
+) {
+	const uint32_t dd = ((const Tile8x8p4_t*)d1)->d[row] << 16;
+	render_sprite_row_n_pal(&dd, 2, d2, r, x, spriteId, 8);
+}
+
+void __not_in_flash_func(sprite_renderer_sprite_16x16_p4)(
+	const void* d1,
+	const void* d2,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const int32_t row,
+	const SpriteId spriteId
+) {
+	render_sprite_row_n_pal(&((const Tile16x16p4_t*)d1)->d[row], 2, d2, r, x, spriteId, 16);
+}
+
+void __not_in_flash_func(sprite_renderer_sprite_8x8_p16)(
+	const void* d1,
+	const void* d2,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const int32_t row,
+	const SpriteId spriteId
+) {
+	render_sprite_row_n_pal(&((const Tile8x8p16_t*)d1)->d[row], 4, d2, r, x, spriteId, 8);
+}
+
+void __not_in_flash_func(sprite_renderer_sprite_16x16_p16)(
+	const void* d1,
+	const void* d2,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const int32_t row,
+	const SpriteId spriteId
+) {
+	render_sprite_row_n_pal(((const Tile16x16p16_t*)d1)->d[row], 4, d2, r, x, spriteId, 16);
+}
+
+void __not_in_flash_func(sprite_renderer_sprite_8x8_c)(
+	const void* d1,
+	const void* d2,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const int32_t row,
+	const SpriteId spriteId
+) {
+	render_sprite_row_n_direct(((const Tile8x8c_t*)d1)->d[row], *(const hstx_dvi_pixel_t*)d2, r, x, spriteId, 8);
+}
+
+void __not_in_flash_func(sprite_renderer_sprite_16x16_c)(
+	const void* d1,
+	const void* d2,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const int32_t row,
+	const SpriteId spriteId
+) {
+	render_sprite_row_n_direct(((const Tile16x16c_t*)d1)->d[row], *(const hstx_dvi_pixel_t*)d2, r, x, spriteId, 16);
+}
+
+// Draw a row of a group. The live cells are ORed into a pair of aligned
+// words, left to right, and each word is blitted once it is complete, so a
+// row costs a blit per word with cells in it rather than one per cell.
+static __force_inline void render_group_row(
+	const SpriteGroup* g,
+	const hstx_dvi_pixel_t* p,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const uint32_t row,
+	const SpriteId spriteId,
+	const uint32_t tw
+) {
+	const uint32_t cy = row / g->dy;
+	const uint32_t k = row - __mul_instruction(cy, g->dy);
+	if (cy >= g->rows || k >= g->h) return;
+	if (g->colours) p = &g->colours[cy];
+	const uint32_t c0 = __mul_instruction(cy, g->cols);
+	int32_t wx = 0;
+	uint32_t acc = 0, carry = 0;
+	for (uint32_t cx = 0; cx < g->cols; ++cx) {
+		const uint32_t i = c0 + cx;
+		if (!(g->alive[i >> 5] & (1u << (i & 31)))) continue;
+		const int32_t cellx = x + (int32_t)__mul_instruction(cx, g->dx);
+		if (cellx >= MODE_H_ACTIVE_PIXELS) break;
+		if (cellx + (int32_t)g->w <= 0) continue;
+		const uint32_t t = (g->frames ? g->frames[i] : 0) * g->h + k;
+		const uint32_t d = tw == 16 ? (uint32_t)((const uint16_t*)g->tiles)[t] << 16 : ((const uint32_t*)g->tiles)[t];
+		if (!d) continue;
+		const int32_t cwx = cellx & ~31;
+		if (cwx != wx) {
+			if (acc) blit_sprite_row_p1(acc, p, r, wx, spriteId, 32);
+			if (cwx == wx + 32) {
+				acc = carry;
+			}
+			else {
+				if (carry) blit_sprite_row_p1(carry, p, r, wx + 32, spriteId, 32);
+				acc = 0;
+			}
+			carry = 0;
+			wx = cwx;
+		}
+		const uint64_t v = ((uint64_t)d << 32) >> (cellx & 31);
+		acc |= (uint32_t)(v >> 32);
+		carry |= (uint32_t)v;
+	}
+	if (acc) blit_sprite_row_p1(acc, p, r, wx, spriteId, 32);
+	if (carry) blit_sprite_row_p1(carry, p, r, wx + 32, spriteId, 32);
+}
+
+void __not_in_flash_func(sprite_renderer_group_16_p1)(
+	const void* d1,
+	const void* d2,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const int32_t row,
+	const SpriteId spriteId
+) {
+	render_group_row(d1, d2, r, x, row, spriteId, 16);
+}
+
+void __not_in_flash_func(sprite_renderer_group_32_p1)(
+	const void* d1,
+	const void* d2,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const int32_t row,
+	const SpriteId spriteId
+) {
+	render_group_row(d1, d2, r, x, row, spriteId, 32);
+}
+
+int32_t hstx_dvi_sprite_group_cell_at(const Sprite* sprite, const int32_t x, const int32_t y) {
+	const SpriteGroup* const g = sprite->d1;
+	const int32_t gx = x - sprite->x;
+	const int32_t gy = y - sprite->y;
+	if (gx < 0 || gy < 0) return -1;
+	const uint32_t cx = (uint32_t)gx / g->dx;
+	const uint32_t cy = (uint32_t)gy / g->dy;
+	if (cx >= g->cols || cy >= g->rows) return -1;
+	if ((uint32_t)gx - cx * g->dx >= g->w || (uint32_t)gy - cy * g->dy >= g->h) return -1;
+	return (int32_t)(cy * g->cols + cx);
+}
+
 void __not_in_flash_func(text_renderer_8x8_p1)(
 	const void* d1,
 	const void* d2,
@@ -429,35 +1270,177 @@ void __not_in_flash_func(render_Tile16x16p2)(
 	}
 }
 
+// Scroll positions wrap round the map
+static __force_inline uint32_t bg_wrap(const int32_t v, const uint32_t n) {
+	const int32_t m = v % (int32_t)n;
+	return (uint32_t)(m < 0 ? m + (int32_t)n : m);
+}
+
+// Mark where the background row has its transparent colour, so the layers
+// behind it can be clipped a word at a time
+static void __not_in_flash_func(bg_clear_row)(
+	const hstx_dvi_row_t* r,
+	const hstx_dvi_pixel_t key,
+	uint32_t* c
+) {
+#if MODE_BITS_PER_PIXEL >= 8
+	const uint32_t kw = hstx_dvi_blit_pixel_word(key);
+	const uint32_t* rw = r->w;
+	for (uint32_t i = 0; i < SPRITE_OCC_ROW_WORDS; ++i) {
+		uint32_t m = 0;
+		for (uint32_t k = 0; k < (32 >> HSTX_DVI_BLIT_SHIFT); ++k, ++rw) {
+			// Row words past the end of the line are left as zero bits
+			const uint32_t v = rw < &r->w[count_of(r->w)] ? *rw ^ kw : ~0u;
+#if MODE_BITS_PER_PIXEL == 8
+			const uint32_t opaque = hstx_dvi_blit_taken(v);
+#else
+			const uint32_t opaque = ((v & 0xffff) ? 2 : 0) | ((v >> 16) ? 1 : 0);
+#endif
+			m = (m << HSTX_DVI_BLIT_PIXELS) | (~opaque & HSTX_DVI_BLIT_BITS);
+		}
+		c[i] = m;
+	}
+#else
+	for (uint32_t i = 0; i < SPRITE_OCC_ROW_WORDS; ++i) {
+		uint32_t m = 0;
+		for (uint32_t j = 0; j < 32; ++j) {
+			const uint32_t x = (i << 5) + j;
+			const uint32_t b = x * MODE_BITS_PER_PIXEL;
+			const bool clear = x < MODE_H_ACTIVE_PIXELS &&
+				((r->w[b >> 5] >> (b & 31)) & HSTX_DVI_PIXEL_MASK) == key;
+			m = (m << 1) | clear;
+		}
+		c[i] = m;
+	}
+#endif
+}
+
+static void __not_in_flash_func(render_background)(
+	hstx_dvi_row_t* r,
+	const uint32_t y
+) {
+	const SpriteBackground* const bg = &_front_state->background;
+	SpriteBgLine* const line = &_bgLine[render_core()];
+	const uint32_t yy = bg_wrap(bg->sy + (int32_t)y, bg->h << 3);
+	const uint32_t xx = bg_wrap(bg->sx + (bg->line_sx ? bg->line_sx[y] : 0), bg->w << 3);
+	const uint8_t* const map = bg->map + __mul_instruction(yy >> 3, bg->w);
+	const uint32_t ty = yy & 7;
+	// Copy whole tile rows from the first tile on the line
+	uint32_t tx = xx >> 3;
+	uint8_t* b = line->b;
+	for (uint32_t i = 0; i < SPRITE_BG_TILES; ++i, b += SPRITE_BG_TILE_ROW_BYTES) {
+		memcpy(b, bg->tiles[map[tx]].d[ty], SPRITE_BG_TILE_ROW_BYTES);
+		if (++tx == bg->w) tx = 0;
+	}
+	// Then shift out the pixels of the first tile that are off the left
+	// edge, a word at a time. Pixels are packed first pixel lowest.
+	const uint32_t bits = (xx & 7) * MODE_BITS_PER_PIXEL;
+	const uint32_t* const src = &line->w[bits >> 5];
+	const uint32_t sh = bits & 31;
+	if (sh) {
+		for (uint32_t k = 0; k < count_of(r->w); ++k) {
+			r->w[k] = (src[k] >> sh) | (src[k + 1] << (32 - sh));
+		}
+	}
+	else {
+		memcpy(r->w, src, sizeof(r->w));
+	}
+	if (bg->key) bg_clear_row(r, *bg->key, _bgClear[render_core()]);
+}
+
+static __force_inline void render_sprite_line(
+	hstx_dvi_row_t* r,
+	const SpriteId i,
+	const uint32_t y,
+	const uint32_t start
+) {
+	const Sprite *sprite = &_front_state->sprites[i];
+	const uint32_t k = (y - sprite->y) >> hstx_dvi_sprite_get_zoom(sprite);
+	if ((sprite-> f & SF_ENABLE) && k < sprite->h)
+	{
+#if HSTX_DVI_SPRITE_BUDGET
+		// Once the line is out of time the sprites left are skipped
+		const uint32_t core = render_core();
+		if (_budgetCut[core] || (_line_budget && budget_elapsed(start) > _line_budget)) {
+			_budgetCut[core] = true;
+			_budgetFrame[core].sprites_skipped++;
+			return;
+		}
+#else
+		(void)start;
+#endif
+		(sprite->r)(
+			sprite->d1,
+			sprite->d2,
+			r,
+			sprite->x,
+			sprite->f & SF_VFLIP ? sprite->h - 1 - k : k,
+			i);
+	}
+}
+
 void __not_in_flash_func(hstx_dvi_sprite_render_frame)(uint32_t frame_index) {
 		
 	//clear_sprite_collisions();
 	for (uint32_t y = 0; y < MODE_V_ACTIVE_LINES; ++y) {
-		hstx_dvi_row_t *r = hstx_dvi_row_buf_get();
-		clear_sprite_id_row();
+		hstx_dvi_sprite_render_line(frame_index, y);
+	}
+}
+
+void __not_in_flash_func(hstx_dvi_sprite_render_line)(uint32_t frame_index, uint32_t y) {
+	// Don't render lines the scan-out has gone past
+	if (hstx_dvi_row_fifo_is_stale(frame_index, y)) return;
+	hstx_dvi_row_t *r = hstx_dvi_row_buf_acquire();
+	// Time spent waiting for a free row is not the line's to spend
+#if HSTX_DVI_SPRITE_BUDGET
+	const uint32_t start = budget_cycles();
+#else
+	const uint32_t start = 0;
+#endif
+	clear_sprite_id_row();
 
+	if (_front_state->background.tiles) {
+		render_background(r, y);
+	}
+	else {
 		// Render a blank row
-		// TODO optionally render a tiled background
 		render_row_mono(
 			r,
 			hstx_dvi_pixel_rgb(0, 0, 0));
+	}
 
-		for (uint32_t i = 0; i < MAX_SPRITES; ++i)
-		{
-			const Sprite *sprite = &_sprites_rdy[i];
-			const uint32_t k = y - sprite->y;
-			if ((sprite-> f & SF_ENABLE) && k < sprite->h)
-			{
-				(sprite->r)(
-					sprite->d1,
-					sprite->d2,
-					r,
-					sprite->x,
-					k,
-					i);
-			}
+	// Layers behind an opaque background can't be seen, and with no
+	// background at all they aren't clipped
+	const SpriteBackground* const bg = &_front_state->background;
+	const uint32_t layers = bg->tiles && !bg->key ? HSTX_DVI_SPRITE_BG_LAYER : SPRITE_LAYERS;
+	const uint32_t core = render_core();
+	SpriteEdges* const e = walk_edges(frame_index, y);
+	for (uint32_t l = 0; l < layers; ++l) {
+		if (l == HSTX_DVI_SPRITE_BG_LAYER && bg->tiles) _clip[core] = _bgClear[core];
+		// Sprites the line is past their bottom of leave the list
+		SpriteId* const s = e->s[l];
+		uint32_t kept = 0;
+		for (uint32_t j = 0; j < e->n[l]; ++j) {
+			const SpriteId i = s[j];
+			const Sprite* const sprite = &_front_state->sprites[i];
+			if ((int32_t)y >= sprite->y + (int32_t)(sprite->h << hstx_dvi_sprite_get_zoom(sprite))) continue;
+			s[kept++] = i;
+			render_sprite_line(r, i, y, start);
 		}
-		hstx_dvi_row_fifo_put_blocking(r);
+		e->n[l] = (uint16_t)kept;
+	}
+	_clip[core] = 0;
+#if HSTX_DVI_SPRITE_BUDGET
+	SpriteBudgetStats* const bs = &_budgetFrame[core];
+	const uint32_t cycles = budget_elapsed(start);
+	bs->line_cycles_total += cycles;
+	if (cycles > bs->line_cycles_max) bs->line_cycles_max = cycles;
+	if (_budgetCut[core]) {
+		_budgetCut[core] = false;
+		bs->lines_cut++;
+		if (y < bs->first_cut_line) bs->first_cut_line = y;
 	}
+#endif
+	hstx_dvi_row_fifo_put_blocking(r, frame_index, y);
 }
 
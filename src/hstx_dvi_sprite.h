@@ -23,12 +23,71 @@ typedef struct {
 	uint32_t d[16];
 } Tile32x16p2_t;
 
+// Paletted tiles, first pixel in the top bits. Colour 0 is transparent and
+// d2 points at the palette.
+typedef struct {
+	uint16_t d[8];
+} Tile8x8p4_t;
+
+typedef struct {
+	uint32_t d[16];
+} Tile16x16p4_t;
+
+typedef struct {
+	uint32_t d[8];
+} Tile8x8p16_t;
+
+typedef struct {
+	uint32_t d[16][2];
+} Tile16x16p16_t;
+
+// Direct colour tiles, d2 points at the transparent colour
+typedef struct {
+	hstx_dvi_pixel_t d[8][8];
+} Tile8x8c_t;
+
+typedef struct {
+	hstx_dvi_pixel_t d[16][16];
+} Tile16x16c_t;
+
+// Background tiles, 8x8 pixels packed in the row format so a tile row is
+// MODE_BITS_PER_PIXEL bytes that can be copied straight into a row
+#define SPRITE_BG_TILE_ROW_BYTES MODE_BITS_PER_PIXEL
+
+typedef struct {
+	uint8_t d[8][SPRITE_BG_TILE_ROW_BYTES];
+} TileBg8x8_t;
+
+__force_inline void hstx_dvi_sprite_bg_tile_set_pixel(
+	TileBg8x8_t* t,
+	const uint32_t x,
+	const uint32_t y,
+	const hstx_dvi_pixel_t p
+) {
+	hstx_dvi_row_set_pixel((hstx_dvi_row_t*)t->d[y], x, p);
+}
+
 typedef struct {
 	uint16_t w;
 	uint8_t *s;
 	uint8_t *font;
 } TextGrid8_t;
 
+// A grid of 1 bit per pixel cells drawn as one sprite, e.g. a formation of
+// invaders. Cell (cx, cy) is at (x + cx * dx, y + cy * dy) and is drawn
+// when bit cy * cols + cx of alive is set. Its tile is frames[cell], or 0
+// with no frames. Tiles are h rows, first pixel in the top bit. The cells
+// all share the sprite's id, so collisions are with the whole group.
+typedef struct {
+	uint16_t cols, rows;
+	uint16_t dx, dy; // distance between cells
+	uint16_t w, h; // cell size, w up to the renderer's tile width
+	const void* tiles;
+	const uint8_t* frames; // cols * rows tile numbers, or null
+	const uint32_t* alive; // a bit per cell, cell i in bit i & 31 of word i >> 5
+	const hstx_dvi_pixel_t* colours; // a colour for each row of cells, or null for d2
+} SpriteGroup;
+
 typedef uint8_t SpriteId;
 typedef uint32_t SpriteCollisionMask;
 
@@ -53,19 +112,151 @@ typedef struct Sprite {
 	SpriteRenderer r;
 } Sprite;
 
+// Sprites are drawn a layer at a time, layer 0 in front, and in sprite order
+// within a layer. The layer is kept in the flags. Layers from
+// HSTX_DVI_SPRITE_BG_LAYER on are behind the background, and only show
+// through its transparent colour.
+#define SPRITE_LAYERS 4
+#define SF_LAYER_SHIFT 1
+#define SF_LAYER_MASK (3 << SF_LAYER_SHIFT)
+#define SF_LAYER(L) ((L) << SF_LAYER_SHIFT)
+
+#ifndef HSTX_DVI_SPRITE_BG_LAYER
+#define HSTX_DVI_SPRITE_BG_LAYER 3
+#endif
+
+__force_inline uint32_t hstx_dvi_sprite_get_layer(const Sprite* sprite) {
+	return (sprite->f & SF_LAYER_MASK) >> SF_LAYER_SHIFT;
+}
+
+__force_inline void hstx_dvi_sprite_set_layer(Sprite* sprite, const uint32_t layer) {
+	sprite->f = (sprite->f & ~SF_LAYER_MASK) | SF_LAYER(layer & (SPRITE_LAYERS - 1));
+}
+
+// Mirroring and zoom. w and h stay the size of the tile; a zoomed sprite
+// covers (w << zoom) x (h << zoom) pixels of the screen. Rows are flipped
+// and zoomed for any renderer, columns by the built in sprite renderers.
+#define SF_HFLIP (1 << 3)
+#define SF_VFLIP (1 << 4)
+#define SF_ZOOM_SHIFT 5
+#define SF_ZOOM_MASK (3 << SF_ZOOM_SHIFT)
+#define SF_ZOOM2 (1 << SF_ZOOM_SHIFT)
+#define SF_ZOOM4 (2 << SF_ZOOM_SHIFT)
+
+// The zoom as a shift, 0 to 2
+__force_inline uint32_t hstx_dvi_sprite_get_zoom(const Sprite* sprite) {
+	const uint32_t z = (sprite->f & SF_ZOOM_MASK) >> SF_ZOOM_SHIFT;
+	return z > 2 ? 2 : z;
+}
+
 #define MAX_SPRITES ((1<<8)-1)
 
-extern Sprite _sprites[MAX_SPRITES];
+// A scrolling tiled background drawn under the sprites. The map holds w x h
+// tile numbers, row by row, and wraps in both directions. Scroll x can be
+// offset per screen line, e.g. for parallax. The settings are taken with
+// the sprites at the start of each frame; the map, tiles and line offsets
+// are read as the lines are drawn. With no tiles the background is black,
+// and sprites behind it show everywhere.
+typedef struct {
+	const TileBg8x8_t* tiles;
+	const uint8_t* map;
+	uint16_t w, h;
+	int32_t sx, sy;
+	const int16_t* line_sx; // MODE_V_ACTIVE_LINES offsets, or null
+	const hstx_dvi_pixel_t* key; // transparent colour, or null
+} SpriteBackground;
+
+
+// Cores rendering rows, 1 or 2. With 2, core 0 renders lines for the next
+// frame while it waits in hstx_dvi_sprite_wait_for_frame, taking lines from
+// the same counter as core 1. Needs HSTX_DVI_ROW_FIFO_LANES 2.
+#ifndef HSTX_DVI_SPRITE_CORES
+#define HSTX_DVI_SPRITE_CORES 1
+#endif
+
+// Each frame the enabled sprites are sorted by the band of 2^SHIFT lines
+// their top line is in. Walking down the frame, a sprite joins a list of the
+// sprites on the line at its band and leaves after its bottom line, so a
+// line only looks at the sprites on it. 0 joins sprites at their top line.
+#ifndef HSTX_DVI_SPRITE_BAND_SHIFT
+#define HSTX_DVI_SPRITE_BAND_SHIFT 3
+#endif
+
+// Build with HSTX_DVI_SPRITE_BUDGET=1 to time each line on the core that
+// renders it. Once a line has used up its budget of cycles the rest of its
+// sprites, the lowest priority ones, are skipped, so the line is still
+// delivered in time. HSTX_DVI_SPRITE_LINE_BUDGET is the starting budget in
+// cycles, 0 for no limit.
+#ifndef HSTX_DVI_SPRITE_BUDGET
+#define HSTX_DVI_SPRITE_BUDGET 0
+#endif
+#ifndef HSTX_DVI_SPRITE_LINE_BUDGET
+#define HSTX_DVI_SPRITE_LINE_BUDGET 0
+#endif
 
+typedef struct {
+	uint32_t frame;             // Frame these are for
+	uint32_t lines_cut;         // Lines that ran out of budget
+	uint32_t first_cut_line;    // First line cut short, or HSTX_DVI_STATS_NONE
+	uint32_t sprites_skipped;   // Sprite rows not drawn
+	uint32_t line_cycles_max;   // Longest line
+	uint32_t line_cycles_total; // All lines
+	uint32_t total_lines_cut;   // Since init
+} SpriteBudgetStats;
+
+// Everything the game core sets up for a frame. There are three: the game
+// core writes to the back one, the renderer draws from the front one and
+// the third holds the last one published. hstx_dvi_sprite_publish swaps the
+// back and published ones, and the renderer swaps the published one to the
+// front when it starts a frame if it is newer, so the renderer never copies
+// sprites. The game core brings its new back buffer up to date instead, by
+// copying the sprites changed since the state that buffer holds.
+typedef struct {
+	Sprite sprites[MAX_SPRITES];
+	SpriteBackground background;
+} SpriteState;
+
+// The back buffer, only use from the game core
+extern SpriteState* _sprite_state;
+// The sequence number the back buffer will be published as, and the last
+// one each sprite was got for, with the background's after them
+extern uint32_t _sprite_back_seq;
+extern uint32_t _sprite_changed_seq[MAX_SPRITES + 1];
+
+// Getting a sprite or the background marks it as changed in the back buffer
 __force_inline Sprite* hstx_dvi_sprite_get(const SpriteId spriteId) {
-	return &_sprites[spriteId];
+	_sprite_changed_seq[spriteId] = _sprite_back_seq;
+	return &_sprite_state->sprites[spriteId];
+}
+
+__force_inline SpriteBackground* hstx_dvi_sprite_get_background() {
+	_sprite_changed_seq[MAX_SPRITES] = _sprite_back_seq;
+	return &_sprite_state->background;
 }
 
+// Hand the back buffer to the renderer, which takes it when it next starts
+// a frame, and carry on in another with the same state. Only the sprites got
+// since that buffer was last published are copied into it. Returns the
+// sequence number of the state published. hstx_dvi_sprite_wait_for_frame
+// publishes too.
+uint32_t hstx_dvi_sprite_publish();
+
+// Sequence number of the state the renderer is drawing, 0 before the first
+uint32_t hstx_dvi_sprite_get_shown_seq();
+
+// Set the cycles a line may take before its sprites are skipped, 0 for no
+// limit. Needs HSTX_DVI_SPRITE_BUDGET.
+void hstx_dvi_sprite_set_line_budget(uint32_t cycles);
+
+// Copy the line budget statistics for the last complete frame. Returns
+// false if they are not built in.
+bool hstx_dvi_sprite_get_budget_stats(SpriteBudgetStats* stats);
+
 __force_inline void hstx_dvi_sprite_disable_1(Sprite* sprite) {
 	sprite->f &= ~SF_ENABLE;
 }
 __force_inline void hstx_dvi_sprite_disable(const SpriteId spriteId) {
-	hstx_dvi_sprite_disable_1(&_sprites[spriteId]);
+	hstx_dvi_sprite_disable_1(hstx_dvi_sprite_get(spriteId));
 }
 
 void hstx_dvi_sprite_init_all();
@@ -81,7 +272,7 @@ __force_inline void init_sprite(
 	void * const d2,
 	SpriteRenderer r
 ) {
-	Sprite *s = &_sprites[i];
+	Sprite *s = hstx_dvi_sprite_get(i);
 	s->x = x;
 	s->y = y;
 	s->w = w;
@@ -92,6 +283,33 @@ __force_inline void init_sprite(
 	s->r = r;
 }
 
+// Set up a sprite to draw a group, with r one of the group renderers. The
+// sprite covers the whole grid. The group is read as lines are drawn, so
+// changes to it show straight away rather than when published.
+__force_inline void init_sprite_group(
+	const int i,
+	const int32_t x,
+	const int32_t y,
+	const uint32_t f,
+	const SpriteGroup * const g,
+	const hstx_dvi_pixel_t * const p,
+	SpriteRenderer r
+) {
+	init_sprite(
+		i,
+		x,
+		y,
+		(g->cols - 1) * g->dx + g->w,
+		(g->rows - 1) * g->dy + g->h,
+		f,
+		(void*)g,
+		(void*)p,
+		r);
+}
+
+// The cell of a group sprite under a screen position, alive or not, or -1
+int32_t hstx_dvi_sprite_group_cell_at(const Sprite* sprite, const int32_t x, const int32_t y);
+
 // ----------------------------------------------------------------------------
 // Sprite collisions
 // 
@@ -101,9 +319,36 @@ __force_inline void init_sprite(
 
 typedef union {
 	SpriteId id[MODE_H_ACTIVE_PIXELS];
+	uint16_t half[SPRITE_ID_ROW_WORDS << 1];
 	uint32_t word[SPRITE_ID_ROW_WORDS];
 } SpriteIdRow;
 
+// With HSTX_DVI_SPRITE_COLLISION_BITMAP 1 a sprite sets a bit per drawn
+// pixel in an occupancy bitmap, 32 pixels at a time, rather than writing its
+// id into every pixel, and keeps a mask of the pixels it drew. The sprite
+// that owns a pixel is only looked up when another sprite lands on it, so
+// the collisions are the same as with the id row.
+#ifndef HSTX_DVI_SPRITE_COLLISION_BITMAP
+#define HSTX_DVI_SPRITE_COLLISION_BITMAP 0
+#endif
+
+#define SPRITE_OCC_ROW_WORDS ((MODE_H_ACTIVE_PIXELS + 31) >> 5)
+
+typedef struct {
+	uint32_t m;    // pixels drawn in the word
+	uint16_t i;    // bitmap word
+	SpriteId id;
+} SpriteRowMask;
+
+// A sprite has an entry for each word it drew in, however many times it
+// drew there, e.g. as a group or a zoomed sprite. Every entry has pixels no
+// other has, so there are never more than a row's pixels of them.
+typedef struct {
+	uint32_t occ[SPRITE_OCC_ROW_WORDS]; // first pixel in the top bit
+	uint32_t n;
+	SpriteRowMask drawn[MODE_H_ACTIVE_PIXELS];
+} SpriteOccupancyRow;
+
 typedef union {
 	SpriteCollisionMask m[MAX_SPRITES];
 } SpriteCollisions;
@@ -148,6 +393,82 @@ void sprite_renderer_sprite_32x16_p1(
 	const SpriteId spriteId
 );
 
+// 4 colour (2 bits per pixel) and 16 colour (4 bits per pixel) sprites
+void sprite_renderer_sprite_8x8_p4(
+	const void* d1,
+	const void* d2,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const int32_t row,
+	const SpriteId spriteId
+);
+
+void sprite_renderer_sprite_16x16_p4(
+	const void* d1,
+	const void* d2,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const int32_t row,
+	const SpriteId spriteId
+);
+
+void sprite_renderer_sprite_8x8_p16(
+	const void* d1,
+	const void* d2,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const int32_t row,
+	const SpriteId spriteId
+);
+
+void sprite_renderer_sprite_16x16_p16(
+	const void* d1,
+	const void* d2,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const int32_t row,
+	const SpriteId spriteId
+);
+
+// Sprites in the row pixel format, with a transparent colour
+void sprite_renderer_sprite_8x8_c(
+	const void* d1,
+	const void* d2,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const int32_t row,
+	const SpriteId spriteId
+);
+
+void sprite_renderer_sprite_16x16_c(
+	const void* d1,
+	const void* d2,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const int32_t row,
+	const SpriteId spriteId
+);
+
+// Group renderers, for cells with 16 and 32 bit tile rows (e.g. arrays of
+// Tile16x8p2_t and Tile32x16p2_t). Groups are not flipped or zoomed.
+void sprite_renderer_group_16_p1(
+	const void* d1,
+	const void* d2,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const int32_t row,
+	const SpriteId spriteId
+);
+
+void sprite_renderer_group_32_p1(
+	const void* d1,
+	const void* d2,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const int32_t row,
+	const SpriteId spriteId
+);
+
 void text_renderer_8x8_p1(
 	const void* d1,
 	const void* d2,
@@ -166,6 +487,7 @@ void render_Tile16x16p2(
 );
 
 void hstx_dvi_sprite_render_frame(uint32_t frame_index);
+void hstx_dvi_sprite_render_line(uint32_t frame_index, uint32_t y);
 
 void hstx_dvi_sprite_wait_for_frame();
 
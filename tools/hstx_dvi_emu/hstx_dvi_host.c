@@ -0,0 +1,133 @@
+// Host stand-ins for the parts of the Pico SDK the HSTX DVI core uses.
+
+#include "hstx_dvi_host.h"
+#include "hstx_emu.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static dma_hw_t _dma_hw;
+static hstx_ctrl_hw_t _hstx_ctrl_hw;
+static hstx_fifo_hw_t _hstx_fifo_hw;
+static bus_ctrl_hw_t _bus_ctrl_hw;
+static systick_hw_t _systick_hw;
+
+dma_hw_t *dma_hw = &_dma_hw;
+hstx_ctrl_hw_t *hstx_ctrl_hw = &_hstx_ctrl_hw;
+hstx_fifo_hw_t *hstx_fifo_hw = &_hstx_fifo_hw;
+bus_ctrl_hw_t *bus_ctrl_hw = &_bus_ctrl_hw;
+systick_hw_t *systick_hw = &_systick_hw;
+
+static irq_handler_t _irq_handlers[32];
+
+void panic(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    fputs("panic: ", stderr);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+    exit(1);
+}
+
+void sleep_ms(uint32_t ms) {
+}
+
+// ----------------------------------------------------------------------------
+// DMA
+
+dma_channel_config dma_channel_get_default_config(uint channel) {
+    // As the SDK: 32-bit, read increment, chained to itself, unpaced
+    dma_channel_config c;
+    c.ctrl =
+        DMA_CH0_CTRL_TRIG_EN_BITS |
+        (DMA_SIZE_32 << DMA_CH0_CTRL_TRIG_DATA_SIZE_LSB) |
+        DMA_CH0_CTRL_TRIG_INCR_READ_BITS |
+        (channel << DMA_CH0_CTRL_TRIG_CHAIN_TO_LSB) |
+        (0x3fu << DMA_CH0_CTRL_TRIG_TREQ_SEL_LSB);
+    return c;
+}
+
+void channel_config_set_chain_to(dma_channel_config* c, uint chain_to) {
+    c->ctrl = (c->ctrl & ~DMA_CH0_CTRL_TRIG_CHAIN_TO_BITS) | (chain_to << DMA_CH0_CTRL_TRIG_CHAIN_TO_LSB);
+}
+
+void channel_config_set_dreq(dma_channel_config* c, uint dreq) {
+    c->ctrl = (c->ctrl & ~(0x3fu << DMA_CH0_CTRL_TRIG_TREQ_SEL_LSB)) | (dreq << DMA_CH0_CTRL_TRIG_TREQ_SEL_LSB);
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config* c, enum dma_channel_transfer_size size) {
+    c->ctrl = (c->ctrl & ~DMA_CH0_CTRL_TRIG_DATA_SIZE_BITS) | ((uint32_t)size << DMA_CH0_CTRL_TRIG_DATA_SIZE_LSB);
+}
+
+void channel_config_set_read_increment(dma_channel_config* c, bool incr) {
+    c->ctrl = incr ? c->ctrl | DMA_CH0_CTRL_TRIG_INCR_READ_BITS : c->ctrl & ~DMA_CH0_CTRL_TRIG_INCR_READ_BITS;
+}
+
+void channel_config_set_write_increment(dma_channel_config* c, bool incr) {
+    c->ctrl = incr ? c->ctrl | DMA_CH0_CTRL_TRIG_INCR_WRITE_BITS : c->ctrl & ~DMA_CH0_CTRL_TRIG_INCR_WRITE_BITS;
+}
+
+void channel_config_set_ring(dma_channel_config* c, bool write, uint size_bits) {
+    c->ctrl = (c->ctrl & ~(0xfu << DMA_CH0_CTRL_TRIG_RING_SIZE_LSB) & ~DMA_CH0_CTRL_TRIG_RING_SEL_BITS) |
+        (size_bits << DMA_CH0_CTRL_TRIG_RING_SIZE_LSB) |
+        (write ? DMA_CH0_CTRL_TRIG_RING_SEL_BITS : 0);
+}
+
+void channel_config_set_irq_quiet(dma_channel_config* c, bool irq_quiet) {
+    c->ctrl = irq_quiet ? c->ctrl | DMA_CH0_CTRL_TRIG_IRQ_QUIET_BITS : c->ctrl & ~DMA_CH0_CTRL_TRIG_IRQ_QUIET_BITS;
+}
+
+uint32_t channel_config_get_ctrl_value(const dma_channel_config* c) {
+    return c->ctrl;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config* c, volatile void* write_addr,
+                           const volatile void* read_addr, uint transfer_count, bool trigger) {
+    dma_channel_hw_t* ch = &dma_hw->ch[channel];
+    ch->read_addr = (uintptr_t)read_addr;
+    ch->write_addr = (uintptr_t)write_addr;
+    ch->transfer_count = transfer_count;
+    ch->ctrl_trig = c->ctrl;
+    ch->al1_ctrl = c->ctrl;
+    if (trigger) dma_channel_start(channel);
+}
+
+void dma_channel_start(uint channel) {
+    hstx_emu_dma_start(channel);
+}
+
+bool dma_channel_is_busy(uint channel) {
+    return hstx_emu_dma_busy(channel);
+}
+
+// ----------------------------------------------------------------------------
+// IRQ
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler) {
+    _irq_handlers[num] = handler;
+}
+
+void irq_set_enabled(uint num, bool enabled) {
+}
+
+irq_handler_t hstx_dvi_host_get_irq_handler(uint num) {
+    return _irq_handlers[num];
+}
+
+// ----------------------------------------------------------------------------
+// Clocks, power and GPIO
+
+bool set_sys_clock_khz(uint32_t freq_khz, bool required) {
+    return true;
+}
+
+void clock_configure_int_divider(enum clock_index clk_index, uint32_t src, uint32_t auxsrc,
+                                 uint32_t src_freq, uint32_t int_divider) {
+}
+
+void vreg_set_voltage(enum vreg_voltage voltage) {
+}
+
+void gpio_set_function(uint gpio, uint fn) {
+}
@@ -0,0 +1,97 @@
+// Host stand-ins for the parts of the Pico SDK that deal with the two cores,
+// for tests that run threads as cores.
+
+#include "hstx_dvi_host.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static _Thread_local uint _core_num = 0;
+
+uint get_core_num(void) {
+    return _core_num;
+}
+
+void hstx_dvi_host_set_core_num(uint core) {
+    _core_num = core;
+}
+
+// Not panic, which is in hstx_dvi_host.c and needs the emulator
+static void fail(const char* s) {
+    fprintf(stderr, "hstx_dvi_host: %s\n", s);
+    exit(1);
+}
+
+// ----------------------------------------------------------------------------
+// Core 1
+
+static void* core1_main(void* entry) {
+    hstx_dvi_host_set_core_num(1);
+    ((void (*)(void))entry)();
+    return 0;
+}
+
+void multicore_launch_core1(void (*entry)(void)) {
+    pthread_t thread;
+    if (pthread_create(&thread, 0, core1_main, (void*)entry)) fail("cannot start core 1");
+    pthread_detach(thread);
+}
+
+// ----------------------------------------------------------------------------
+// Spin locks and semaphores, which spin yielding the CPU
+
+static spin_lock_t _spin_locks[32];
+static uint32_t _spin_locks_claimed = 0;
+
+uint spin_lock_claim_unused(bool required) {
+    const uint32_t n = __atomic_fetch_add(&_spin_locks_claimed, 1, __ATOMIC_RELAXED);
+    if (n >= count_of(_spin_locks)) {
+        if (required) fail("no spin locks left");
+        return (uint)-1;
+    }
+    return n;
+}
+
+spin_lock_t* spin_lock_init(uint lock_num) {
+    _spin_locks[lock_num] = 0;
+    return &_spin_locks[lock_num];
+}
+
+uint32_t spin_lock_blocking(spin_lock_t* lock) {
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) sched_yield();
+    return 0;
+}
+
+void spin_unlock(spin_lock_t* lock, uint32_t saved_irq) {
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+void sem_init(struct semaphore* sem, int16_t initial_permits, int16_t max_permits) {
+    sem->lock = 0;
+    sem->permits = initial_permits;
+    sem->max_permits = max_permits;
+}
+
+int sem_available(struct semaphore* sem) {
+    return __atomic_load_n(&sem->permits, __ATOMIC_ACQUIRE);
+}
+
+bool sem_release(struct semaphore* sem) {
+    spin_lock_blocking(&sem->lock);
+    const bool released = sem->permits < sem->max_permits;
+    if (released) ++sem->permits;
+    spin_unlock(&sem->lock, 0);
+    return released;
+}
+
+bool sem_try_acquire(struct semaphore* sem) {
+    spin_lock_blocking(&sem->lock);
+    const bool acquired = sem->permits > 0;
+    if (acquired) --sem->permits;
+    spin_unlock(&sem->lock, 0);
+    return acquired;
+}
+
+void sem_acquire_blocking(struct semaphore* sem) {
+    while (!sem_try_acquire(sem)) sched_yield();
+}
@@ -0,0 +1,417 @@
+#include "hstx_emu.h"
+#include "hstx_dvi_core.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TMDS_CTRL_00 0x354u
+#define TMDS_CTRL_01 0x0abu
+#define TMDS_CTRL_10 0x154u
+#define TMDS_CTRL_11 0x2abu
+
+static __force_inline uint32_t rotr(const uint32_t w, const uint32_t n) {
+    return n ? (w >> n) | (w << (32 - n)) : w;
+}
+
+// ----------------------------------------------------------------------------
+// Frame capture
+
+static const hstx_emu_config_t* _config;
+static const hstx_dvi_mode_t* _mode;
+static uint8_t* _rgb;
+
+static bool _hsync = false;
+static bool _vsync = false;
+static bool _synced = false;
+static bool _vsync_started = false;
+static uint64_t _clock = 0;
+
+// Current line
+static uint64_t _line_start = 0;
+static uint32_t _line = 0;
+static uint32_t _line_pixels = 0;
+static uint32_t _row = 0;
+
+// Current frame
+static uint64_t _frame_start = 0;
+static uint32_t _frame = 0;
+static uint32_t _bad_lines = 0;
+static uint32_t _irqs = 0;
+static uint64_t _min_slack = UINT64_MAX;
+static uint32_t _min_slack_line = 0;
+static uint32_t _bad_frames = 0;
+
+static void write_ppm() {
+    char name[256];
+    snprintf(name, sizeof(name), "%s_%04u.ppm", _config->ppm_prefix, (uint)_frame);
+    FILE* f = fopen(name, "wb");
+    if (!f) panic("hstx_emu: cannot write %s", name);
+    fprintf(f, "P6\n%u %u\n255\n", (uint)_mode->h_active_pixels, (uint)_mode->v_active_lines);
+    fwrite(_rgb, 3, (size_t)_mode->h_active_pixels * _mode->v_active_lines, f);
+    fclose(f);
+}
+
+static void end_line() {
+    const uint64_t clocks = _clock - _line_start;
+    if (clocks != hstx_dvi_mode_h_total(_mode)) ++_bad_lines;
+    if (_config->line_log) {
+        fprintf(_config->line_log, "%u,%u,%llu,%u\n",
+            (uint)_frame, (uint)_line, (unsigned long long)clocks, (uint)_line_pixels);
+    }
+    if (_line_pixels) {
+        if (_config->row_done && _row < _mode->v_active_lines) {
+            _config->row_done(_row, &_rgb[(size_t)_row * _mode->h_active_pixels * 3]);
+        }
+        ++_row;
+    }
+    ++_line;
+    _line_pixels = 0;
+    _line_start = _clock;
+}
+
+static void end_frame() {
+    const uint64_t clocks = _clock - _frame_start;
+    const bool bad = _bad_lines ||
+        _line != hstx_dvi_mode_v_total(_mode) ||
+        _row != _mode->v_active_lines;
+    if (bad) ++_bad_frames;
+    if (_config->frame_log) {
+        const double slack_us = _min_slack == UINT64_MAX ? 0.0 : (_min_slack * 1000.0) / _mode->pixel_clock_khz;
+        fprintf(_config->frame_log, "%u,%llu,%u,%u,%u,%u,%llu,%.2f,%u\n",
+            (uint)_frame, (unsigned long long)clocks, (uint)_line, (uint)_row, (uint)_bad_lines,
+            (uint)_irqs, (unsigned long long)(_min_slack == UINT64_MAX ? 0 : _min_slack), slack_us,
+            (uint)_min_slack_line);
+    }
+    if (_config->ppm_prefix) write_ppm();
+    ++_frame;
+    _line = 0;
+    _row = 0;
+    _bad_lines = 0;
+    _irqs = 0;
+    _min_slack = UINT64_MAX;
+    _frame_start = _clock;
+    memset(_rgb, 0, (size_t)_mode->h_active_pixels * _mode->v_active_lines * 3);
+}
+
+static void out_ctrl(const uint32_t sym) {
+    // Lane 0 carries the syncs
+    uint32_t c;
+    switch (sym & 0x3ff) {
+        case TMDS_CTRL_00: c = 0; break;
+        case TMDS_CTRL_01: c = 1; break;
+        case TMDS_CTRL_10: c = 2; break;
+        case TMDS_CTRL_11: c = 3; break;
+        default: c = 0; break;
+    }
+    const bool hsync = (c & 1) == (_mode->h_sync_polarity == HSTX_DVI_SYNC_POSITIVE);
+    const bool vsync = (c >> 1) == (_mode->v_sync_polarity == HSTX_DVI_SYNC_POSITIVE);
+    // Lines start at the hsync edge, and frames at the hsync edge of the
+    // line vsync starts on
+    if (vsync && !_vsync) {
+        _vsync_started = true;
+    }
+    if (hsync && !_hsync) {
+        if (_synced) end_line();
+        if (_vsync_started) {
+            if (_synced) end_frame();
+            _synced = true;
+            _vsync_started = false;
+            _frame_start = _clock;
+            _line_start = _clock;
+        }
+    }
+    _hsync = hsync;
+    _vsync = vsync;
+    ++_clock;
+}
+
+void hstx_emu_pixel_rgb(const uint32_t w, uint8_t rgb[3]) {
+    const uint32_t tmds = hstx_ctrl_hw->expand_tmds;
+    for (uint32_t i = 0; i < 3; ++i) {
+        const uint32_t f = tmds >> (i * 8);
+        const uint32_t rot = f & 0x1f;
+        const uint32_t nbits = (f >> 5) & 0x7;
+        // Lane i carries blue, green then red, and takes the top nbits + 1
+        // bits of the rotated low byte
+        rgb[2 - i] = rotr(w, rot) & (0xff00u >> (nbits + 1));
+    }
+}
+
+static void out_pixel(const uint32_t w) {
+    if (_synced && _line_pixels < _mode->h_active_pixels && _row < _mode->v_active_lines) {
+        hstx_emu_pixel_rgb(w, &_rgb[((size_t)_row * _mode->h_active_pixels + _line_pixels) * 3]);
+    }
+    ++_line_pixels;
+    ++_clock;
+}
+
+// ----------------------------------------------------------------------------
+// Command expander
+
+#define CMD_RAW         0x0u
+#define CMD_RAW_REPEAT  0x1u
+#define CMD_TMDS        0x2u
+#define CMD_TMDS_REPEAT 0x3u
+#define CMD_NOP         0xfu
+
+static uint32_t _cmd = CMD_NOP;
+static uint32_t _left = 0;
+
+// Shift out up to n values from a data word
+static void expand(const uint32_t w, const uint32_t n, const bool tmds) {
+    const uint32_t shift = hstx_ctrl_hw->expand_shift;
+    uint32_t n_shifts = tmds ? (shift >> 24) & 0x1f : (shift >> 8) & 0x1f;
+    const uint32_t s = tmds ? (shift >> 16) & 0x1f : shift & 0x1f;
+    if (!n_shifts) n_shifts = 32;
+    uint32_t d = w;
+    for (uint32_t i = 0; i < n; ++i) {
+        if (tmds) out_pixel(d); else out_ctrl(d);
+        // Repeats start again on the word each time it is used up
+        d = (i + 1) % n_shifts ? rotr(d, s) : w;
+    }
+}
+
+static void expander_put(const uint32_t w) {
+    if (!_left) {
+        _cmd = w >> 12;
+        _left = w & 0xfff;
+        if (_cmd == CMD_NOP) _left = 0;
+        return;
+    }
+    const uint32_t shift = hstx_ctrl_hw->expand_shift;
+    uint32_t n;
+    switch (_cmd) {
+        case CMD_RAW:
+        case CMD_TMDS: {
+            const bool tmds = _cmd == CMD_TMDS;
+            n = tmds ? (shift >> 24) & 0x1f : (shift >> 8) & 0x1f;
+            if (!n) n = 32;
+            if (n > _left) n = _left;
+            expand(w, n, tmds);
+            break;
+        }
+        case CMD_RAW_REPEAT:
+        case CMD_TMDS_REPEAT:
+            n = _left;
+            expand(w, n, _cmd == CMD_TMDS_REPEAT);
+            break;
+        default:
+            panic("hstx_emu: bad HSTX command 0x%x", (uint)_cmd);
+    }
+    _left -= n;
+}
+
+// ----------------------------------------------------------------------------
+// DMA
+
+static int _running = -1;
+
+// When each of the last HSTX_FIFO_WORDS words left the FIFO, a transfer
+// finishes when there is room for its last word.
+static uint64_t _pop_clock[HSTX_FIFO_WORDS];
+static uint64_t _words = 0;
+static uint64_t _irq_clock = 0;
+static bool _irq_pending = false;
+// An IRQ raised but not yet handled, and the transfers left before its
+// handler runs
+static bool _irq_raised = false;
+static uint32_t _irq_wait = 0;
+// When the last transfer finished
+static uint64_t _done_clock = 0;
+
+// A channel that loads another from a ring of control blocks, as the data
+// channel's alias 0 registers. The block after the ring is the one that
+// jumps back to the start.
+typedef struct {
+    uintptr_t read_addr;
+    uintptr_t write_addr;
+    uint32_t transfer_count;
+    uint32_t ctrl_trig;
+} ctrl_block_t;
+
+static uintptr_t _ring_base = 0;
+static uint32_t _ring_blocks = 0;
+// The block whose load the handler for the last half IRQ had until to
+// refill its half
+static uint32_t _ring_deadline = 0;
+
+void hstx_emu_dma_start(uint channel) {
+    _running = channel;
+}
+
+bool hstx_emu_dma_busy(uint channel) {
+    return _running == (int)channel;
+}
+
+static bool is_dma_reg(const uintptr_t addr) {
+    return addr >= (uintptr_t)dma_hw && addr < (uintptr_t)(dma_hw + 1);
+}
+
+static bool is_hstx_ctrl_reg(const uintptr_t addr) {
+    return addr >= (uintptr_t)hstx_ctrl_hw && addr < (uintptr_t)(hstx_ctrl_hw + 1);
+}
+
+// Does the channel load control blocks into another? It writes a whole
+// block at a time to DMA registers, where the jump back to the start of the
+// ring writes just the one.
+static bool is_block_loader(const uint channel) {
+    const dma_channel_hw_t* ch = &dma_hw->ch[channel];
+    return is_dma_reg(ch->write_addr) && ch->transfer_count == sizeof(ctrl_block_t) / sizeof(uint32_t);
+}
+
+// Find the ring a loader is about to run through, by the jump block after it
+static void find_ring(const uint channel) {
+    const ctrl_block_t* b = (const ctrl_block_t*)dma_hw->ch[channel].read_addr;
+    _ring_base = (uintptr_t)b;
+    _ring_blocks = 0;
+    while (!is_dma_reg(b[_ring_blocks].write_addr)) {
+        if (++_ring_blocks > 1024) panic("hstx_emu: no end to the DMA ring");
+    }
+}
+
+static uint32_t ring_index(const uint channel) {
+    return (dma_hw->ch[channel].read_addr - _ring_base) / sizeof(ctrl_block_t);
+}
+
+static void note_slack(const uint64_t done) {
+    const uint64_t slack = done - _irq_clock;
+    if (slack < _min_slack) {
+        _min_slack = slack;
+        _min_slack_line = _line;
+    }
+    _irq_pending = false;
+}
+
+// Load the next control block, which triggers the channel it loads. Returns
+// that channel.
+static uint dma_load_block(const uint channel) {
+    dma_channel_hw_t* ch = &dma_hw->ch[channel];
+    dma_channel_hw_t* to = (dma_channel_hw_t*)ch->write_addr;
+    if ((uintptr_t)to != (uintptr_t)&to->read_addr || to < dma_hw->ch || to >= dma_hw->ch + NUM_DMA_CHANNELS) {
+        panic("hstx_emu: control blocks must go to a channel's alias 0 registers");
+    }
+    if (_irq_pending && _ring_blocks && ring_index(channel) == _ring_deadline) note_slack(_done_clock);
+    const ctrl_block_t* b = (const ctrl_block_t*)ch->read_addr;
+    to->read_addr = b->read_addr;
+    to->write_addr = b->write_addr;
+    to->transfer_count = b->transfer_count;
+    // Aliases of the same register, the emulator reads al1_ctrl
+    to->ctrl_trig = b->ctrl_trig;
+    to->al1_ctrl = b->ctrl_trig;
+    ch->read_addr += sizeof(ctrl_block_t);
+    return (uint)(to - dma_hw->ch);
+}
+
+static uint64_t dma_put(const uint32_t w) {
+    const uint32_t i = _words++ % HSTX_FIFO_WORDS;
+    const uint64_t room = _words > HSTX_FIFO_WORDS ? _pop_clock[i] : 0;
+    _pop_clock[i] = _clock;
+    expander_put(w);
+    return room;
+}
+
+static void run_irq_handler() {
+    _irq_raised = false;
+    irq_handler_t handler = hstx_dvi_host_get_irq_handler(DMA_IRQ_0);
+    if (handler) handler();
+    ++_irqs;
+}
+
+static void dma_run_transfer() {
+    // A late handler gets going once the IRQ has waited long enough
+    if (_irq_raised && !--_irq_wait) run_irq_handler();
+    const uint channel = _running;
+    if (is_block_loader(channel)) {
+        if (!_ring_blocks) find_ring(channel);
+        _running = dma_load_block(channel);
+        return;
+    }
+    dma_channel_hw_t* ch = &dma_hw->ch[channel];
+    const uint32_t ctrl = ch->al1_ctrl;
+    const uint32_t size = (ctrl & DMA_CH0_CTRL_TRIG_DATA_SIZE_BITS) >> DMA_CH0_CTRL_TRIG_DATA_SIZE_LSB;
+    const uint32_t count = ch->transfer_count & 0x0fffffff;
+    uintptr_t addr = ch->read_addr;
+    uintptr_t write_addr = ch->write_addr;
+    uint64_t done = _clock;
+    if (write_addr == (uintptr_t)&hstx_fifo_hw->fifo) {
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t w;
+            // Narrow writes are replicated across the bus
+            switch (size) {
+                case DMA_SIZE_8: w = *(const uint8_t*)addr * 0x01010101u; break;
+                case DMA_SIZE_16: w = *(const uint16_t*)addr * 0x00010001u; break;
+                default: w = *(const uint32_t*)addr; break;
+            }
+            if (ctrl & DMA_CH0_CTRL_TRIG_INCR_READ_BITS) addr += 1u << size;
+            done = dma_put(w);
+        }
+    }
+    else if (is_hstx_ctrl_reg(write_addr) && size == DMA_SIZE_32) {
+        // Expander setup, e.g. a format switch, takes effect from the next
+        // word out of the FIFO
+        for (uint32_t i = 0; i < count; ++i) {
+            *(io_rw_32*)write_addr = *(const uint32_t*)addr;
+            if (ctrl & DMA_CH0_CTRL_TRIG_INCR_READ_BITS) addr += 4;
+            if (ctrl & DMA_CH0_CTRL_TRIG_INCR_WRITE_BITS) write_addr += 4;
+        }
+    }
+    else if (is_dma_reg(write_addr) && !((write_addr - (uintptr_t)dma_hw->ch) % sizeof(dma_channel_hw_t)) && count == 1) {
+        // Sending a loader back to the start of its ring. Addresses are host
+        // pointer sized.
+        *(io_rw_ptr*)write_addr = *(const uintptr_t*)addr;
+    }
+    else {
+        panic("hstx_emu: DMA channel %u writes to an unknown address", channel);
+    }
+    ch->read_addr = addr;
+    ch->transfer_count = 0;
+    _done_clock = done;
+
+    // The handler for the last IRQ had until now to reload its channel
+    if (_irq_pending && !_ring_blocks) note_slack(done);
+
+    const uint chain_to = (ctrl & DMA_CH0_CTRL_TRIG_CHAIN_TO_BITS) >> DMA_CH0_CTRL_TRIG_CHAIN_TO_LSB;
+    _running = chain_to != channel ? (int)chain_to : -1;
+    // The block that just finished, before the loader moves past the next one
+    const uint32_t block = _running >= 0 && _ring_blocks && is_block_loader(_running)
+        ? ring_index(_running) - 1
+        : 0;
+    if (!(ctrl & DMA_CH0_CTRL_TRIG_IRQ_QUIET_BITS) && (dma_hw->inte0 & (1u << channel))) {
+        // A loader has the next block in a few cycles, well before the
+        // handler gets going
+        if (_running >= 0 && is_block_loader(_running)) _running = dma_load_block(_running);
+        dma_hw->intr |= 1u << channel;
+        // An IRQ raised again before its handler runs is the one IRQ
+        if (!_irq_raised) {
+            _irq_raised = true;
+            _irq_wait = _config->irq_delay;
+            if (!_irq_wait) run_irq_handler();
+        }
+        // In ring mode only the IRQs at the end of each half refill, and they
+        // have until the data channel gets back round to that half
+        const uint32_t half = _ring_blocks >> 1;
+        if (!_ring_blocks || block == half - 1 || block == _ring_blocks - 1) {
+            _irq_clock = done;
+            _irq_pending = true;
+            _ring_deadline = block == half - 1 ? 0 : half;
+        }
+    }
+}
+
+uint32_t hstx_emu_run(const hstx_emu_config_t* config, const uint32_t frames) {
+    _config = config;
+    _mode = hstx_dvi_get_mode();
+    _rgb = calloc((size_t)_mode->h_active_pixels * _mode->v_active_lines, 3);
+    if (config->frame_log) {
+        fprintf(config->frame_log, "frame,clocks,lines,active_rows,bad_lines,irqs,min_irq_slack_clocks,min_irq_slack_us,min_irq_slack_line\n");
+    }
+    if (config->line_log) {
+        fprintf(config->line_log, "frame,line,clocks,pixels\n");
+    }
+    // Capture starts at the first vsync
+    while (_frame < frames) {
+        if (_running < 0) panic("hstx_emu: DMA stopped");
+        dma_run_transfer();
+    }
+    free(_rgb);
+    return _bad_frames;
+}
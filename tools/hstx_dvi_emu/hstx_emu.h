@@ -0,0 +1,40 @@
+#pragma once
+
+// Host emulation of the DMA channels and HSTX command expander driven by the
+// HSTX DVI core. Transfers are run in order, the core's DMA IRQ handler is
+// called as each one completes, and the expander's output is turned back
+// into frames and timings.
+
+#include "hstx_dvi_host.h"
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    const char* ppm_prefix;     // Frames are written to <prefix>_NNNN.ppm, NULL for none
+    FILE* frame_log;            // Per frame timing CSV, may be NULL
+    FILE* line_log;             // Per line timing CSV, may be NULL
+    // Called with each active row's RGB as it completes, may be NULL
+    void (*row_done)(uint32_t row, const uint8_t* rgb);
+    // DMA transfers, control block loads included, an IRQ handler runs
+    // after its IRQ is raised. 0 runs it straight away. Only ring mode has
+    // the slack for a late handler.
+    uint32_t irq_delay;
+} hstx_emu_config_t;
+
+// What the HSTX shows for a pixel in the current format
+void hstx_emu_pixel_rgb(const uint32_t w, uint8_t rgb[3]);
+
+// Called by the host SDK stand-ins
+void hstx_emu_dma_start(uint channel);
+bool hstx_emu_dma_busy(uint channel);
+
+// Run until the given number of whole frames have been captured. Returns the
+// number of frames that did not match the mode's timing.
+uint32_t hstx_emu_run(const hstx_emu_config_t* config, const uint32_t frames);
+
+#ifdef __cplusplus
+}
+#endif
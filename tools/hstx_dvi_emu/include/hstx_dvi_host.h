@@ -0,0 +1,211 @@
+#pragma once
+
+// Just enough of the Pico SDK to build the HSTX DVI core on a host machine.
+// Peripheral registers are plain memory, which the emulator reads back to
+// see what the core set up, and DMA channels are driven by the emulator.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sched.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef unsigned int uint;
+typedef volatile uint32_t io_rw_32;
+// Wide enough to hold a host pointer
+typedef volatile uintptr_t io_rw_ptr;
+
+#define __force_inline inline __attribute__((always_inline))
+#define __not_in_flash_func(f) f
+#define __time_critical_func(f) f
+#define __scratch_x(s)
+#define __scratch_y(s)
+#define __not_in_flash(s)
+#define __aligned(n) __attribute__((aligned(n)))
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+
+// Waiting threads give up the CPU rather than sleep until an event
+static inline void __wfe(void) { sched_yield(); }
+static inline void __sev(void) {}
+static inline void __dmb(void) { __sync_synchronize(); }
+static inline void tight_loop_contents(void) {}
+
+void panic(const char* fmt, ...) __attribute__((noreturn));
+void sleep_ms(uint32_t ms);
+
+// ----------------------------------------------------------------------------
+// Cores
+//
+// Host tests run threads as cores, see hstx_dvi_host_cores.c
+
+uint get_core_num(void);
+// Say which core the calling thread stands in for, 0 by default
+void hstx_dvi_host_set_core_num(uint core);
+
+// Runs entry on a new thread as core 1
+void multicore_launch_core1(void (*entry)(void));
+
+typedef volatile uint32_t spin_lock_t;
+uint spin_lock_claim_unused(bool required);
+spin_lock_t* spin_lock_init(uint lock_num);
+uint32_t spin_lock_blocking(spin_lock_t* lock);
+void spin_unlock(spin_lock_t* lock, uint32_t saved_irq);
+
+struct semaphore {
+    spin_lock_t lock;
+    int16_t permits;
+    int16_t max_permits;
+};
+void sem_init(struct semaphore* sem, int16_t initial_permits, int16_t max_permits);
+int sem_available(struct semaphore* sem);
+bool sem_release(struct semaphore* sem);
+void sem_acquire_blocking(struct semaphore* sem);
+bool sem_try_acquire(struct semaphore* sem);
+
+static inline uint32_t __mul_instruction(uint32_t a, uint32_t b) { return a * b; }
+
+// ----------------------------------------------------------------------------
+// DMA
+
+#define NUM_DMA_CHANNELS 16
+
+typedef struct {
+    io_rw_ptr read_addr;
+    io_rw_ptr write_addr;
+    io_rw_32 transfer_count;
+    io_rw_32 ctrl_trig;
+    // Channels are only ever reloaded through this alias
+    io_rw_32 al1_ctrl;
+} dma_channel_hw_t;
+
+typedef struct {
+    dma_channel_hw_t ch[NUM_DMA_CHANNELS];
+    io_rw_32 intr;
+    io_rw_32 inte0;
+    io_rw_32 ints0;
+} dma_hw_t;
+
+extern dma_hw_t *dma_hw;
+
+#define DREQ_HSTX 52
+
+#define DMA_CH0_CTRL_TRIG_EN_BITS          0x00000001u
+#define DMA_CH0_CTRL_TRIG_DATA_SIZE_LSB    2
+#define DMA_CH0_CTRL_TRIG_DATA_SIZE_BITS   0x0000000cu
+#define DMA_CH0_CTRL_TRIG_INCR_READ_BITS   0x00000010u
+#define DMA_CH0_CTRL_TRIG_INCR_WRITE_BITS  0x00000040u
+#define DMA_CH0_CTRL_TRIG_RING_SIZE_LSB    8
+#define DMA_CH0_CTRL_TRIG_RING_SEL_BITS    0x00001000u
+#define DMA_CH0_CTRL_TRIG_CHAIN_TO_LSB     13
+#define DMA_CH0_CTRL_TRIG_CHAIN_TO_BITS    0x0001e000u
+#define DMA_CH0_CTRL_TRIG_TREQ_SEL_LSB     17
+#define DMA_CH0_CTRL_TRIG_IRQ_QUIET_BITS   0x00800000u
+
+enum dma_channel_transfer_size { DMA_SIZE_8 = 0, DMA_SIZE_16 = 1, DMA_SIZE_32 = 2 };
+
+typedef struct {
+    uint32_t ctrl;
+} dma_channel_config;
+
+dma_channel_config dma_channel_get_default_config(uint channel);
+void channel_config_set_chain_to(dma_channel_config* c, uint chain_to);
+void channel_config_set_dreq(dma_channel_config* c, uint dreq);
+void channel_config_set_transfer_data_size(dma_channel_config* c, enum dma_channel_transfer_size size);
+void channel_config_set_read_increment(dma_channel_config* c, bool incr);
+void channel_config_set_write_increment(dma_channel_config* c, bool incr);
+void channel_config_set_ring(dma_channel_config* c, bool write, uint size_bits);
+void channel_config_set_irq_quiet(dma_channel_config* c, bool irq_quiet);
+uint32_t channel_config_get_ctrl_value(const dma_channel_config* c);
+void dma_channel_configure(uint channel, const dma_channel_config* c, volatile void* write_addr,
+                           const volatile void* read_addr, uint transfer_count, bool trigger);
+void dma_channel_start(uint channel);
+bool dma_channel_is_busy(uint channel);
+
+// ----------------------------------------------------------------------------
+// IRQ
+
+#define DMA_IRQ_0 10
+
+typedef void (*irq_handler_t)(void);
+void irq_set_exclusive_handler(uint num, irq_handler_t handler);
+void irq_set_enabled(uint num, bool enabled);
+irq_handler_t hstx_dvi_host_get_irq_handler(uint num);
+
+// ----------------------------------------------------------------------------
+// HSTX
+
+typedef struct {
+    io_rw_32 csr;
+    io_rw_32 bit[8];
+    io_rw_32 expand_shift;
+    io_rw_32 expand_tmds;
+} hstx_ctrl_hw_t;
+
+extern hstx_ctrl_hw_t *hstx_ctrl_hw;
+
+typedef struct {
+    io_rw_32 stat;
+    io_rw_32 fifo;
+} hstx_fifo_hw_t;
+
+extern hstx_fifo_hw_t *hstx_fifo_hw;
+
+#define HSTX_CTRL_CSR_EN_BITS                    0x00000001u
+#define HSTX_CTRL_CSR_EXPAND_EN_BITS             0x00000002u
+#define HSTX_CTRL_CSR_SHIFT_LSB                  8
+#define HSTX_CTRL_CSR_N_SHIFTS_LSB               16
+#define HSTX_CTRL_CSR_CLKDIV_LSB                 28
+#define HSTX_CTRL_BIT0_SEL_P_LSB                 0
+#define HSTX_CTRL_BIT0_SEL_N_LSB                 8
+#define HSTX_CTRL_BIT0_INV_BITS                  0x00010000u
+#define HSTX_CTRL_BIT0_CLK_BITS                  0x00020000u
+#define HSTX_CTRL_EXPAND_SHIFT_RAW_SHIFT_LSB     0
+#define HSTX_CTRL_EXPAND_SHIFT_RAW_N_SHIFTS_LSB  8
+#define HSTX_CTRL_EXPAND_SHIFT_ENC_SHIFT_LSB     16
+#define HSTX_CTRL_EXPAND_SHIFT_ENC_N_SHIFTS_LSB  24
+#define HSTX_CTRL_EXPAND_TMDS_L0_ROT_LSB         0
+#define HSTX_CTRL_EXPAND_TMDS_L0_NBITS_LSB       5
+#define HSTX_CTRL_EXPAND_TMDS_L1_ROT_LSB         8
+#define HSTX_CTRL_EXPAND_TMDS_L1_NBITS_LSB       13
+#define HSTX_CTRL_EXPAND_TMDS_L2_ROT_LSB         16
+#define HSTX_CTRL_EXPAND_TMDS_L2_NBITS_LSB       21
+
+// ----------------------------------------------------------------------------
+// Clocks, power, GPIO and the rest
+
+enum clock_index { clk_sys = 0, clk_hstx = 1 };
+#define CLOCKS_CLK_HSTX_CTRL_AUXSRC_VALUE_CLK_SYS 0
+
+bool set_sys_clock_khz(uint32_t freq_khz, bool required);
+void clock_configure_int_divider(enum clock_index clk_index, uint32_t src, uint32_t auxsrc,
+                                 uint32_t src_freq, uint32_t int_divider);
+
+enum vreg_voltage { VREG_VOLTAGE_1_20 = 1, VREG_VOLTAGE_1_30 = 2 };
+void vreg_set_voltage(enum vreg_voltage voltage);
+
+void gpio_set_function(uint gpio, uint fn);
+
+typedef struct {
+    io_rw_32 priority;
+} bus_ctrl_hw_t;
+
+extern bus_ctrl_hw_t *bus_ctrl_hw;
+
+#define BUSCTRL_BUS_PRIORITY_DMA_R_BITS 0x00000100u
+#define BUSCTRL_BUS_PRIORITY_DMA_W_BITS 0x00001000u
+
+typedef struct {
+    io_rw_32 csr;
+    io_rw_32 rvr;
+    io_rw_32 cvr;
+    io_rw_32 calib;
+} systick_hw_t;
+
+extern systick_hw_t *systick_hw;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,2 @@
+#pragma once
+#include "hstx_dvi_host.h"
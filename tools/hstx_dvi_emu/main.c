@@ -0,0 +1,294 @@
+// Run the HSTX DVI core on a host machine against an emulated HSTX, writing
+// the frames it produces as PPM images along with timing logs.
+//
+//   hstx_dvi_emu [-m mode] [-n frames] [-o prefix] [-t frames.csv] [-l lines.csv]
+//                [-r h v] [-s] [-u row] [-p policy] [-f format] [-k] [-d blocks] [-w transfers] [-e]
+//
+//   -m  video mode index in hstx_dvi_modes[] or its name (default 0)
+//   -n  number of frames to capture (default 3)
+//   -o  PPM file prefix (default "frame")
+//   -t  per frame timing CSV
+//   -l  per line timing CSV
+//   -r  pixel and line repeat
+//   -s  span encode every fourth row, with one bar in literal pixels, and
+//       check they come out as encoded. The spans are in row pixels and
+//       their commands do the horizontal repeat.
+//   -u  fail to fetch this row once a frame
+//   -p  underflow policy, see hstx_dvi_underflow_policy_t
+//   -f  show the middle quarter of the screen in this format, see
+//       hstx_dvi_format_t
+//   -k  check each fetched row is released once, and paint rows over in
+//       the underflow colour when they are, so an early release shows up
+//   -d  drive the HSTX from a ring of this many DMA control blocks, see
+//       hstx_dvi_set_dma_ring
+//   -w  run the DMA IRQ handler this many transfers late, as a busy core
+//       would. Only a ring has the slack for it.
+//   -e  check there is a vblank event for every frame, the first included,
+//       and that rows are shown in the frame they were fetched for
+//
+// Returns non-zero if any captured frame does not match the mode's timing,
+// a span row does not show what was encoded or an event check fails.
+
+#include "hstx_dvi_core.h"
+#include "hstx_dvi_span.h"
+#include "hstx_emu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Rows are fetched up to a lap of the largest DMA ring ahead of the beam, and
+// released up to a lap behind it
+#define ROWS 128
+
+static hstx_dvi_row_t _rows[ROWS];
+static hstx_dvi_span_row_t _span_rows[ROWS];
+static uint32_t _width;
+static uint32_t _span_width;
+static uint32_t _h_repeat = 1;
+// The ramp shown in literal span bars, in row pixels, and the frame each span
+// row was last encoded for (0 if it was not)
+static hstx_dvi_pixel_t _span_literal[MODE_H_ACTIVE_PIXELS];
+static uint32_t _span_frame[MODE_V_ACTIVE_LINES / 4 + 1];
+static uint32_t _span_errors = 0;
+static uint32_t _v_repeat = 1;
+static uint32_t _height;
+static uint32_t _frame = 0;
+static bool _spans = false;
+static uint32_t _underflow_row = HSTX_DVI_SCANLINE_NONE;
+static bool _underflowed = false;
+static hstx_dvi_format_t _band_format = HSTX_DVI_FORMAT_DEFAULT;
+static uint32_t _band_words[ROWS][MODE_H_ACTIVE_PIXELS / 2];
+static hstx_dvi_row_desc_t _band_rows[ROWS];
+// Rows fetched and not yet released
+static hstx_dvi_row_t* _held[ROWS * 2];
+static uint32_t _held_count = 0;
+static uint32_t _release_errors = 0;
+static bool _check_release = false;
+static bool _check_events = false;
+static uint32_t _vblanks = 0;
+static uint32_t _event_errors = 0;
+
+// The fetch frame of each row, which should be the frame count while it is
+// on screen, 0 if it has not been fetched
+static uint32_t _fetch_frame[MODE_V_ACTIVE_LINES];
+
+static void check_vblank(uint32_t frame, uint32_t scanline) {
+    if (frame != ++_vblanks || scanline != hstx_dvi_get_mode()->v_active_lines) ++_event_errors;
+}
+
+static void check_row_frame(const uint32_t row) {
+    const uint32_t f = _fetch_frame[row / _v_repeat];
+    const uint32_t count = hstx_dvi_get_frame_count();
+    // Rows are done at the hsync after them, and by then the next frame's
+    // vblank may have started after the last one. The first frame is not
+    // fetched.
+    const bool last = row == hstx_dvi_get_mode()->v_active_lines - 1;
+    if (f && f != count && !(last && f + 1 == count)) ++_event_errors;
+}
+
+static void check_release(hstx_dvi_row_t* row) {
+    uint32_t i = 0;
+    while (i < _held_count && _held[i] != row) ++i;
+    if (i == _held_count) {
+        ++_release_errors;
+        return;
+    }
+    memmove(_held + i, _held + i + 1, (--_held_count - i) * sizeof(_held[0]));
+    if (!hstx_dvi_row_is_desc(row)) hstx_dvi_fill_row(row, hstx_dvi_pixel_rgb(0, 255, 0));
+}
+
+static hstx_dvi_row_t* hold(hstx_dvi_row_t* row) {
+    if (!_check_release) return row;
+    if (_held_count == count_of(_held)) {
+        ++_release_errors;
+        return row;
+    }
+    _held[_held_count++] = row;
+    return row;
+}
+
+// Pack a colour into the given format
+static uint32_t band_pixel(const hstx_dvi_format_t f, const uint32_t r, const uint32_t g, const uint32_t b) {
+    switch (f) {
+        case HSTX_DVI_FORMAT_MONO1: return (r + g + b) >= 384;
+        case HSTX_DVI_FORMAT_GREY2: return (r + g + b) / 192;
+        case HSTX_DVI_FORMAT_RGB121: return (r >> 7) << 3 | (g >> 6) << 1 | b >> 7;
+        case HSTX_DVI_FORMAT_RGB332: return (r >> 5) << 5 | (g >> 5) << 2 | b >> 6;
+        default: return (r >> 3) << 11 | (g >> 2) << 5 | b >> 3;
+    }
+}
+
+// Colour bars in the band's format, in screen pixels
+static hstx_dvi_row_t* band_row(const uint32_t row_index) {
+    const uint32_t bits = hstx_dvi_format_bits(_band_format);
+    const uint32_t words = hstx_dvi_format_row_words(_band_format, _span_width);
+    uint32_t* w = _band_words[row_index % ROWS];
+    const uint32_t bar = _span_width >> 3;
+    memset(w, 0, words * sizeof(uint32_t));
+    for (uint32_t x = 0; x < _span_width; ++x) {
+        const uint32_t c = 7 - ((x / bar + _frame) & 7);
+        const uint32_t p = band_pixel(_band_format, c & 4 ? 255 : 0, c & 2 ? 255 : 0, c & 1 ? 255 : 0);
+        w[(x * bits) >> 5] |= p << ((x * bits) & 31);
+    }
+    hstx_dvi_row_desc_t* d = &_band_rows[row_index % ROWS];
+    d->w = w;
+    d->words = words;
+    d->kind = HSTX_DVI_ROW_KIND_PIXELS;
+    d->format = _band_format;
+    return hstx_dvi_row_desc_ref(d);
+}
+
+static hstx_dvi_pixel_t span_bar_colour(const uint32_t i, const uint32_t frame) {
+    const uint32_t c = (i + frame) & 7;
+    return hstx_dvi_pixel_rgb(c & 4 ? 255 : 0, c & 2 ? 255 : 0, c & 1 ? 255 : 0);
+}
+
+// One bar is literal pixels, when it is a whole number of words once
+// repeated. More would not fit in the span row.
+static bool span_bar_literal(const uint32_t i) {
+    return i == 3 && !(((_width >> 3) * _h_repeat) % HSTX_DVI_PIXELS_PER_WORD);
+}
+
+// Check a span row shows its solid bars and literal ramps
+static void check_span_row(const uint32_t row, const uint8_t* rgb) {
+    const uint32_t row_index = row / _v_repeat;
+    if (row_index & 3) return;
+    const uint32_t frame = _span_frame[row_index >> 2];
+    if (!frame) return;
+    const uint32_t bar = _span_width >> 3;
+    for (uint32_t x = 0; x < _span_width; ++x) {
+        const uint32_t i = x / bar;
+        uint8_t expect[3];
+        hstx_emu_pixel_rgb(span_bar_literal(i) ? _span_literal[x / _h_repeat] : span_bar_colour(i, frame), expect);
+        if (memcmp(expect, rgb + x * 3, 3)) {
+            ++_span_errors;
+            return;
+        }
+    }
+}
+
+static void check_row_done(const uint32_t row, const uint8_t* rgb) {
+    if (_spans) check_span_row(row, rgb);
+    if (_check_events) check_row_frame(row);
+}
+
+// Colour bars that move with the frame, and a gradient down the screen
+static hstx_dvi_row_t* test_pattern_rows(uint32_t row_index) {
+    if (row_index == 0) {
+        ++_frame;
+        _underflowed = false;
+    }
+    if ((row_index & 3) == 0) _span_frame[row_index >> 2] = 0;
+    if (row_index == _underflow_row && !_underflowed) {
+        _underflowed = true;
+        return 0;
+    }
+    if (_band_format != HSTX_DVI_FORMAT_DEFAULT && row_index >= _height * 3 / 8 && row_index < _height * 5 / 8) {
+        return band_row(row_index);
+    }
+    const uint32_t bar = _width >> 3;
+    if (_spans && (row_index & 3) == 0) {
+        // Span rows are in row pixels, and their commands repeat them
+        hstx_dvi_span_row_t* r = &_span_rows[(row_index >> 2) % ROWS];
+        hstx_dvi_span_t spans[8];
+        const uint32_t len = _width >> 3;
+        for (uint32_t i = 0; i < 8; ++i) {
+            spans[i].len = len;
+            spans[i].colour = span_bar_colour(i, _frame);
+            spans[i].pixels = span_bar_literal(i) ? &_span_literal[i * len] : 0;
+        }
+        if (hstx_dvi_span_encode_repeat(r, spans, 8, _width, _h_repeat)) {
+            _span_frame[row_index >> 2] = _frame;
+            return hstx_dvi_span_row_ref(r);
+        }
+    }
+    hstx_dvi_row_t* r = &_rows[row_index % ROWS];
+    for (uint32_t x = 0; x < _width; ++x) {
+        const uint32_t c = (x / bar + _frame) & 7;
+        const uint32_t g = (row_index * 255) / MODE_V_ACTIVE_LINES;
+        hstx_dvi_row_set_pixel(r, x, hstx_dvi_pixel_rgb(c & 4 ? 255 : g, c & 2 ? 255 : g, c & 1 ? 255 : g));
+    }
+    return r;
+}
+
+static hstx_dvi_row_t* test_pattern_fetcher(uint32_t row_index) {
+    // The frame being fetched for is the one whose vblank came last
+    _fetch_frame[row_index] = hstx_dvi_get_fetch_frame();
+    hstx_dvi_row_t* row = test_pattern_rows(row_index);
+    return row ? hold(row) : 0;
+}
+
+static const hstx_dvi_mode_t* find_mode(const char* s) {
+    for (uint32_t i = 0; i < hstx_dvi_mode_count; ++i) {
+        if (!strcmp(hstx_dvi_modes[i]->name, s)) return hstx_dvi_modes[i];
+    }
+    const uint32_t i = strtoul(s, 0, 0);
+    if (i >= hstx_dvi_mode_count) panic("hstx_dvi_emu: no video mode %s", s);
+    return hstx_dvi_modes[i];
+}
+
+int main(int argc, char** argv) {
+    const hstx_dvi_mode_t* mode = hstx_dvi_modes[0];
+    uint32_t frames = 3;
+    uint32_t h_repeat = 1;
+    uint32_t v_repeat = 1;
+    hstx_emu_config_t config = { .ppm_prefix = "frame", .frame_log = 0, .line_log = 0, .row_done = 0, .irq_delay = 0 };
+
+    for (int i = 1; i < argc; ++i) {
+        const char* a = argv[i];
+        const bool more = i + 1 < argc;
+        if (!strcmp(a, "-m") && more) mode = find_mode(argv[++i]);
+        else if (!strcmp(a, "-n") && more) frames = strtoul(argv[++i], 0, 0);
+        else if (!strcmp(a, "-o") && more) config.ppm_prefix = argv[++i];
+        else if (!strcmp(a, "-t") && more) config.frame_log = fopen(argv[++i], "w");
+        else if (!strcmp(a, "-l") && more) config.line_log = fopen(argv[++i], "w");
+        else if (!strcmp(a, "-r") && i + 2 < argc) {
+            h_repeat = strtoul(argv[++i], 0, 0);
+            v_repeat = strtoul(argv[++i], 0, 0);
+        }
+        else if (!strcmp(a, "-s")) _spans = true;
+        else if (!strcmp(a, "-u") && more) _underflow_row = strtoul(argv[++i], 0, 0);
+        else if (!strcmp(a, "-p") && more) hstx_dvi_set_underflow_policy(strtoul(argv[++i], 0, 0));
+        else if (!strcmp(a, "-k")) {
+            _check_release = true;
+            hstx_dvi_set_row_release_callback(check_release);
+        }
+        else if (!strcmp(a, "-f") && more) _band_format = strtoul(argv[++i], 0, 0) % HSTX_DVI_FORMAT_COUNT;
+        else if (!strcmp(a, "-d") && more) hstx_dvi_set_dma_ring(strtoul(argv[++i], 0, 0));
+        else if (!strcmp(a, "-w") && more) config.irq_delay = strtoul(argv[++i], 0, 0);
+        else if (!strcmp(a, "-e")) {
+            _check_events = true;
+            hstx_dvi_set_vblank_callback(check_vblank, false);
+        }
+        else {
+            fprintf(stderr, "usage: %s [-m mode] [-n frames] [-o prefix] [-t frames.csv] [-l lines.csv] [-r h v] [-s] [-u row] [-p policy] [-f format] [-k] [-d blocks] [-w transfers] [-e]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    _width = mode->h_active_pixels / h_repeat;
+    _span_width = mode->h_active_pixels;
+    _height = mode->v_active_lines / v_repeat;
+    _h_repeat = h_repeat;
+    _v_repeat = v_repeat;
+    for (uint32_t x = 0; x < _width; ++x) {
+        _span_literal[x] = hstx_dvi_pixel_rgb((x * 255) / _width, 255 - (x * 255) / _width, (x & 3) * 85);
+    }
+    if (_spans || _check_events) config.row_done = check_row_done;
+    hstx_dvi_set_repeat(h_repeat, v_repeat);
+    hstx_dvi_init_mode(mode, test_pattern_fetcher);
+
+    const uint32_t bad = hstx_emu_run(&config, frames);
+
+    printf("%s: %u frames, %u with bad timing\n", mode->name, (uint)frames, (uint)bad);
+    if (_release_errors) printf("%u bad row releases\n", (uint)_release_errors);
+    if (_span_errors) printf("%u bad span rows\n", (uint)_span_errors);
+    if (_check_events) {
+        // Capture ends at the vsync of the frame after the last one
+        if (_vblanks != frames + 1) ++_event_errors;
+        if (_event_errors) printf("%u bad events, %u vblanks\n", (uint)_event_errors, (uint)_vblanks);
+    }
+    if (config.frame_log) fclose(config.frame_log);
+    if (config.line_log) fclose(config.line_log);
+    return bad || _release_errors || _span_errors || _event_errors ? 1 : 0;
+}
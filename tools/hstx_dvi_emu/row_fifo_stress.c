@@ -0,0 +1,124 @@
+// Run the row queue between threads standing in for the cores, and check the
+// scan-out gets every row, in order, e.g.
+//
+//   hstx_dvi_row_fifo_stress [rows]
+//
+// Each lane has a producer thread. The producers take lines in turn, as the
+// dual-core sprite renderer does, and put them with hstx_dvi_row_fifo_try_put
+// or, when a lane is full, hstx_dvi_row_fifo_put_blocking. The main thread
+// is the scan-out and gets the lines in order, waiting for each to arrive,
+// so no row should be thrown away. The frames start just short of where the
+// queue's positions wrap. Returns non-zero if a row is lost, out of order or
+// not what was put.
+
+#include "hstx_dvi_row_fifo.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LINES 480
+// Rows each producer cycles through. A row is written again a lane's worth
+// of puts after the scan-out has had it.
+#define PRODUCER_ROWS (HSTX_DVI_ROW_FIFO_SIZE * 2)
+// Queue positions keep 20 bits of frame
+#define FIRST_FRAME ((1u << 20) - 100)
+
+static hstx_dvi_row_t _rows[HSTX_DVI_ROW_FIFO_LANES][PRODUCER_ROWS];
+static uint32_t _total;
+static volatile uint32_t _next = 0;
+static volatile uint32_t _fetch_frame = FIRST_FRAME;
+static volatile uint32_t _released = 0;
+static uint32_t _full[HSTX_DVI_ROW_FIFO_LANES];
+
+// The core functions the queue calls, with the main thread as the scan-out
+
+uint32_t hstx_dvi_get_fetch_frame() {
+    return _fetch_frame;
+}
+
+uint32_t hstx_dvi_get_row_count() {
+    return LINES;
+}
+
+void hstx_dvi_set_row_fetcher_tagged(const bool tagged) {
+}
+
+void hstx_dvi_release_row(hstx_dvi_row_t* row) {
+    ++_released;
+}
+
+static void* producer(void* arg) {
+    const uint32_t core = (uint32_t)(uintptr_t)arg;
+    hstx_dvi_host_set_core_num(core);
+    uint32_t k = 0;
+    while (true) {
+        const uint32_t n = __atomic_fetch_add(&_next, 1, __ATOMIC_RELAXED);
+        if (n >= _total) break;
+        const uint32_t frame = FIRST_FRAME + n / LINES;
+        const uint32_t line = n % LINES;
+        hstx_dvi_row_t* row = &_rows[core][k++ % PRODUCER_ROWS];
+        row->w[0] = frame;
+        row->w[1] = line;
+        if (!hstx_dvi_row_fifo_try_put(row, frame, line)) {
+            ++_full[core];
+            hstx_dvi_row_fifo_put_blocking(row, frame, line);
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    _total = argc > 1 ? strtoul(argv[1], 0, 0) : 4000000;
+    hstx_dvi_row_fifo_init();
+
+    pthread_t threads[HSTX_DVI_ROW_FIFO_LANES];
+    for (uint32_t c = 0; c < HSTX_DVI_ROW_FIFO_LANES; ++c) {
+        pthread_create(&threads[c], 0, producer, (void*)(uintptr_t)c);
+    }
+
+    uint32_t errors = 0;
+    uint32_t waits = 0;
+    for (uint32_t n = 0; n < _total; ++n) {
+        const uint32_t frame = FIRST_FRAME + n / LINES;
+        const uint32_t line = n % LINES;
+        _fetch_frame = frame;
+        hstx_dvi_row_t* row;
+        // Asking again for a line that hasn't arrived throws nothing away,
+        // and if something has been thrown away the line may never come
+        while (!(row = hstx_dvi_row_fifo_get(line)) && !_released) {
+            ++waits;
+            sched_yield();
+        }
+        if (!row) {
+            printf("line %u of frame %u lost\n", (uint)line, (uint)frame);
+            ++errors;
+            break;
+        }
+        if (row->w[0] != frame || row->w[1] != line) {
+            if (errors < 10) {
+                printf("line %u of frame %u got line %u of frame %u\n",
+                    (uint)line, (uint)frame, (uint)row->w[1], (uint)row->w[0]);
+            }
+            ++errors;
+        }
+    }
+
+    // Don't wait for producers stuck on a full lane
+    if (errors) {
+        printf("%u wrong rows, %u thrown away\n", (uint)errors, (uint)_released);
+        return 1;
+    }
+    for (uint32_t c = 0; c < HSTX_DVI_ROW_FIFO_LANES; ++c) {
+        pthread_join(threads[c], 0);
+    }
+    const uint32_t left = hstx_dvi_row_fifo_get_level();
+    printf("%u rows over %u lanes, %u waits for a row, full lanes",
+        (uint)_total, (uint)HSTX_DVI_ROW_FIFO_LANES, (uint)waits);
+    for (uint32_t c = 0; c < HSTX_DVI_ROW_FIFO_LANES; ++c) printf(" %u", (uint)_full[c]);
+    printf("\n");
+    if (_released || left) {
+        printf("%u rows thrown away, %u left queued\n", (uint)_released, (uint)left);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,185 @@
+// Encode span rows and decode them back, checking the pixels come out as
+// they went in, e.g.
+//
+//   hstx_dvi_span_test
+//
+// Built with rows wider than an HSTX command can count, so full width runs
+// take more than one command. Spans are also encoded with their pixels
+// repeated across, and decoded in screen pixels. Returns non-zero if any case fails.
+
+#include "hstx_dvi_span.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIDTH MODE_H_ACTIVE_PIXELS
+// Enough to overflow the span row with
+#define MAX_SPANS HSTX_DVI_SPAN_ROW_WORDS
+#define MAX_LITERAL (HSTX_DVI_SPAN_ROW_WORDS * HSTX_DVI_PIXELS_PER_WORD)
+
+static hstx_dvi_span_row_t _span_row;
+static hstx_dvi_row_t _expect;
+static hstx_dvi_row_t _got;
+static hstx_dvi_span_t _spans[MAX_SPANS];
+static hstx_dvi_pixel_t _literal[MAX_LITERAL];
+static uint32_t _failures = 0;
+
+static hstx_dvi_pixel_t random_pixel() {
+    return (hstx_dvi_pixel_t)(rand() & ((1u << MODE_BITS_PER_PIXEL) - 1));
+}
+
+// What the spans should decode to, in screen pixels
+static void expect_spans(const uint32_t n, const uint32_t width, const uint32_t h_repeat) {
+    memset(&_expect, 0, sizeof(_expect));
+    uint32_t x = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        for (uint32_t j = 0; j < _spans[i].len * h_repeat && x < width; ++j, ++x) {
+            const uint32_t k = j / h_repeat;
+            hstx_dvi_row_set_pixel(&_expect, x, _spans[i].pixels ? _spans[i].pixels[k] : _spans[i].colour);
+        }
+    }
+}
+
+// width is in row pixels
+static void round_trip_repeat(const char* name, const uint32_t n, const uint32_t row_width, const uint32_t h_repeat) {
+    if (!hstx_dvi_span_encode_repeat(&_span_row, _spans, n, row_width, h_repeat)) {
+        printf("%s: not encoded\n", name);
+        ++_failures;
+        return;
+    }
+    const uint32_t width = row_width * h_repeat;
+    expect_spans(n, width, h_repeat);
+    // Twice, over a row of zeros and a row of ones, so a pixel the decoder
+    // doesn't write can't match by chance. Widths are whole bytes of pixels.
+    const size_t bytes = (width * MODE_BITS_PER_PIXEL) >> 3;
+    for (int fill = 0; fill < 2; ++fill) {
+        memset(&_got, fill ? 0xff : 0, sizeof(_got));
+        const uint32_t decoded = hstx_dvi_span_decode(&_span_row, &_got, width);
+        if (decoded != width) {
+            printf("%s: decoded %u pixels of %u\n", name, (uint)decoded, (uint)width);
+            ++_failures;
+            return;
+        }
+        if (memcmp(&_expect, &_got, bytes)) {
+            printf("%s: pixels differ\n", name);
+            ++_failures;
+            return;
+        }
+    }
+}
+
+static void round_trip(const char* name, const uint32_t n, const uint32_t width) {
+    round_trip_repeat(name, n, width, 1);
+}
+
+static void rejected(const char* name, const uint32_t n, const uint32_t width) {
+    if (hstx_dvi_span_encode(&_span_row, _spans, n, width)) {
+        printf("%s: encoded when it should not be\n", name);
+        ++_failures;
+    }
+}
+
+static void solid(const uint32_t i, const uint32_t len) {
+    _spans[i].len = len;
+    _spans[i].colour = random_pixel();
+    _spans[i].pixels = 0;
+}
+
+static void literal(const uint32_t i, const uint32_t x, const uint32_t len) {
+    _spans[i].len = len;
+    _spans[i].colour = 0;
+    _spans[i].pixels = &_literal[x];
+}
+
+int main(int argc, char** argv) {
+    srand(1);
+    for (uint32_t x = 0; x < MAX_LITERAL; ++x) _literal[x] = random_pixel();
+
+    // Single pixel runs
+    for (uint32_t i = 0; i < 64; ++i) solid(i, 1);
+    round_trip("width 1 solid", 64, 64);
+    if (HSTX_DVI_PIXELS_PER_WORD == 1) {
+        for (uint32_t i = 0; i < 64; ++i) literal(i, i, 1);
+        round_trip("width 1 literal", 64, 64);
+    }
+
+    // Whole rows, wider than a command can count
+    solid(0, WIDTH);
+    round_trip("full width solid", 1, WIDTH);
+    literal(0, 0, WIDTH);
+    round_trip("full width literal", 1, WIDTH);
+
+    // Either side of the command limit
+    solid(0, HSTX_CMD_MAX_COUNT);
+    solid(1, WIDTH - HSTX_CMD_MAX_COUNT);
+    round_trip("solid at the limit", 2, WIDTH);
+    solid(0, HSTX_CMD_MAX_COUNT + 1);
+    solid(1, WIDTH - HSTX_CMD_MAX_COUNT - 1);
+    round_trip("solid past the limit", 2, WIDTH);
+    const uint32_t over = (HSTX_CMD_MAX_COUNT / HSTX_DVI_PIXELS_PER_WORD + 1) * HSTX_DVI_PIXELS_PER_WORD;
+    literal(0, 0, over);
+    solid(1, WIDTH - over);
+    round_trip("literal past the limit", 2, WIDTH);
+
+    // Mixed runs, literal ones a word or more
+    uint32_t n = 0;
+    uint32_t x = 0;
+    while (x < WIDTH) {
+        uint32_t len = 1 + rand() % 300;
+        if (n & 1) len = (len + HSTX_DVI_PIXELS_PER_WORD - 1) / HSTX_DVI_PIXELS_PER_WORD * HSTX_DVI_PIXELS_PER_WORD;
+        // The end of the row is solid
+        if (x + len >= WIDTH) solid(n++, len = WIDTH - x);
+        else if (n & 1) literal(n++, x, len);
+        else solid(n++, len);
+        x += len;
+    }
+    round_trip("mixed", n, WIDTH);
+
+    // Repeated across, with literal runs that make whole words once repeated
+    for (uint32_t h = 2; h <= 4; h <<= 1) {
+        const uint32_t unit = HSTX_DVI_PIXELS_PER_WORD > h ? HSTX_DVI_PIXELS_PER_WORD / h : 1;
+        const uint32_t width = WIDTH / h;
+        n = 0;
+        x = 0;
+        while (x < width) {
+            uint32_t len = 1 + rand() % 200;
+            if (n & 1) len = (len + unit - 1) / unit * unit;
+            if (x + len >= width) solid(n++, len = width - x);
+            else if (n & 1) literal(n++, x, len);
+            else solid(n++, len);
+            x += len;
+        }
+        round_trip_repeat(h == 2 ? "mixed repeated 2x" : "mixed repeated 4x", n, width, h);
+    }
+    // A solid row that is wider than a command can count once repeated
+    solid(0, WIDTH / 2);
+    round_trip_repeat("full width solid repeated", 1, WIDTH / 2, 2);
+    literal(0, 0, HSTX_DVI_PIXELS_PER_WORD > 2 ? HSTX_DVI_PIXELS_PER_WORD / 2 + 1 : 1);
+    if (HSTX_DVI_PIXELS_PER_WORD > 2 && hstx_dvi_span_encode_repeat(&_span_row, _spans, 1, _spans[0].len, 2)) {
+        printf("part word literal repeated: encoded when it should not be\n");
+        ++_failures;
+    }
+    solid(0, 64);
+    if (hstx_dvi_span_encode_repeat(&_span_row, _spans, 1, 64, 3)) {
+        printf("repeat 3: encoded when it should not be\n");
+        ++_failures;
+    }
+
+    // Spans that don't cover the width
+    solid(0, 100);
+    rejected("short", 1, 101);
+    rejected("long", 1, 99);
+    // More commands than the row holds
+    for (uint32_t i = 0; i < MAX_SPANS; ++i) solid(i, 1);
+    rejected("too many solid runs", MAX_SPANS, MAX_SPANS);
+    literal(0, 0, MAX_LITERAL);
+    rejected("too many literal words", 1, MAX_LITERAL);
+    // Literal runs must be whole words
+    if (HSTX_DVI_PIXELS_PER_WORD > 1) {
+        literal(0, 0, HSTX_DVI_PIXELS_PER_WORD + 1);
+        rejected("part word literal", 1, HSTX_DVI_PIXELS_PER_WORD + 1);
+    }
+
+    printf("%u span failures\n", (uint)_failures);
+    return _failures ? 1 : 0;
+}
@@ -0,0 +1,155 @@
+// Run the sprite renderer on a thread standing in for core 1 against the
+// emulated HSTX, publish one state and check every frame shows it, e.g.
+//
+//   hstx_dvi_sprite_emu [-n frames] [-o prefix] [-d blocks] [-p]
+//
+//   -d  drive the HSTX from a ring of this many DMA control blocks, which
+//       the row pool has to be built for, see HSTX_DVI_ROW_BUF_RING_BLOCKS
+//   -p  publish a few more states after it, moving a sprite away and back,
+//       so the last state only shows if each new back buffer is brought up
+//       to date
+//
+// The renderer must keep drawing the last state published for as long as
+// nothing newer comes along. The sprites start and end part way through
+// bands, cover several, run off the top and bottom and sit on different
+// layers, so each has to join and leave the renderer's lists on the right
+// lines. Frames before the renderer has caught up with the scan-out are not
+// checked. Returns non-zero if a checked frame is missing a sprite or has
+// one somewhere else, or if the row pool ran out.
+
+#include "hstx_dvi_sprite.h"
+#include "hstx_dvi_row_fifo.h"
+#include "hstx_dvi_row_buf.h"
+#include "hstx_emu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int32_t x;
+    int32_t y;
+    uint32_t f;
+} emu_sprite_t;
+
+static const emu_sprite_t _sprites[] = {
+    { 100, 100, SF_ENABLE },
+    { 200, 13, SF_ENABLE | SF_ZOOM4 },
+    { 300, -4, SF_ENABLE | SF_LAYER(2) },
+    { 400, 476, SF_ENABLE | SF_LAYER(1) | SF_ZOOM2 },
+    { 500, 97, SF_ENABLE | SF_LAYER(1) | SF_ZOOM2 },
+};
+// Frames the renderer has to catch up
+#define WARM_UP_FRAMES 2
+// Yields to wait for the renderer to refill the queue before giving up
+#define WAIT_YIELDS 100000
+
+static Tile8x8p2_t _tile = { .d = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff } };
+static hstx_dvi_pixel_t _palette[2];
+static uint32_t _frame = 0;
+static uint32_t _bad_rows = 0;
+static uint32_t _bad_frames = 0;
+static bool _frame_bad = false;
+
+static bool in_sprite(const uint32_t x, const uint32_t y) {
+    for (uint32_t i = 0; i < count_of(_sprites); ++i) {
+        const emu_sprite_t* s = &_sprites[i];
+        const int32_t size = 8 << ((s->f & SF_ZOOM_MASK) >> SF_ZOOM_SHIFT);
+        if ((int32_t)x >= s->x && (int32_t)x < s->x + size && (int32_t)y >= s->y && (int32_t)y < s->y + size) return true;
+    }
+    return false;
+}
+
+// The emulator doesn't run in real time, so keep the scan-out from getting
+// ahead of the renderer by giving it time to fill the queue to a level
+static void wait_for_renderer(const uint32_t level) {
+    for (uint32_t i = 0; i < WAIT_YIELDS && hstx_dvi_row_fifo_get_level() < level; ++i) {
+        sched_yield();
+    }
+}
+
+// Vblank is a stretch of the emulation with no rows done, so the next
+// frame's first rows are waited for here
+static void vblank(uint32_t frame, uint32_t scanline) {
+    wait_for_renderer(HSTX_DVI_ROW_FIFO_SIZE);
+}
+
+// In DMA ring mode rows are fetched up to a ring ahead of the one being
+// shown, several at a time, so wait as each row is given back too
+static void release_row(hstx_dvi_row_t* r) {
+    hstx_dvi_row_buf_release(r);
+    wait_for_renderer(HSTX_DVI_ROW_FIFO_SIZE / 2);
+}
+
+static void check_row_done(const uint32_t row, const uint8_t* rgb) {
+    wait_for_renderer(HSTX_DVI_ROW_FIFO_SIZE / 2);
+    if (_frame >= WARM_UP_FRAMES) {
+        const uint32_t w = hstx_dvi_get_mode()->h_active_pixels;
+        for (uint32_t x = 0; x < w; ++x) {
+            const uint8_t* p = &rgb[x * 3];
+            const bool lit = p[0] | p[1] | p[2];
+            if (lit != in_sprite(x, row)) {
+                ++_bad_rows;
+                _frame_bad = true;
+                break;
+            }
+        }
+    }
+    if (row == hstx_dvi_get_mode()->v_active_lines - 1) {
+        if (_frame_bad) {
+            printf("frame %u is wrong\n", (uint)_frame);
+            ++_bad_frames;
+        }
+        _frame_bad = false;
+        ++_frame;
+    }
+}
+
+int main(int argc, char** argv) {
+    hstx_emu_config_t config = { .ppm_prefix = 0, .frame_log = 0, .line_log = 0, .row_done = check_row_done, .irq_delay = 0 };
+    uint32_t frames = 8;
+    bool republish = false;
+    for (int i = 1; i < argc; ++i) {
+        const char* a = argv[i];
+        const bool more = i + 1 < argc;
+        if (!strcmp(a, "-n") && more) frames = strtoul(argv[++i], 0, 0);
+        else if (!strcmp(a, "-o") && more) config.ppm_prefix = argv[++i];
+        else if (!strcmp(a, "-d") && more) hstx_dvi_set_dma_ring(strtoul(argv[++i], 0, 0));
+        else if (!strcmp(a, "-p")) republish = true;
+        else {
+            fprintf(stderr, "usage: %s [-n frames] [-o prefix] [-d blocks] [-p]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    _palette[0] = hstx_dvi_pixel_rgb(255, 255, 255);
+    // As the row queue test app does, so a late row on the way in doesn't
+    // drop whole frames
+    hstx_dvi_set_underflow_policy(HSTX_DVI_UNDERFLOW_BORDER);
+    hstx_dvi_sprite_init_all();
+    hstx_dvi_set_row_release_callback(release_row);
+    for (uint32_t i = 0; i < count_of(_sprites); ++i) {
+        const emu_sprite_t* sp = &_sprites[i];
+        init_sprite(i, sp->x, sp->y, 8, 8, sp->f, &_tile, _palette, sprite_renderer_sprite_8x8_p1);
+    }
+    uint32_t last = hstx_dvi_sprite_publish();
+    if (republish) {
+        hstx_dvi_sprite_get(1)->x += 50;
+        hstx_dvi_sprite_publish();
+        hstx_dvi_sprite_get(1)->x -= 50;
+        hstx_dvi_sprite_publish();
+        hstx_dvi_sprite_publish();
+        last = hstx_dvi_sprite_publish();
+    }
+    // The renderer starts the core, so wait for its first rows
+    while (!hstx_dvi_row_fifo_get_level()) sched_yield();
+    hstx_dvi_set_vblank_callback(vblank, false);
+
+    const uint32_t bad = hstx_emu_run(&config, frames);
+    const uint32_t checked = _frame > WARM_UP_FRAMES ? _frame - WARM_UP_FRAMES : 0;
+    printf("%u frames, %u checked, %u wrong (%u rows), %u with bad timing, showing state %u, %u of %u rows out at most\n",
+        (uint)_frame, (uint)checked, (uint)_bad_frames, (uint)_bad_rows, (uint)bad,
+        (uint)hstx_dvi_sprite_get_shown_seq(), (uint)hstx_dvi_row_buf_get_high_water(), (uint)HSTX_DVI_ROW_BUF_SIZE);
+    // The pool is sized so the renderer never runs out of rows
+    const bool pool_ran_out = hstx_dvi_row_buf_get_high_water() >= HSTX_DVI_ROW_BUF_SIZE;
+    return bad || _bad_frames || !checked || hstx_dvi_sprite_get_shown_seq() != last || pool_ran_out;
+}
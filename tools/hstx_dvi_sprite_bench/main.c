@@ -0,0 +1,242 @@
+// Times the word at a time sprite blitter (hstx_dvi_blit.h), with the id
+// row and with the occupancy bitmap, against the pixel at a time loop the
+// sprite renderer used before, for 8, 16 and 32 pixel wide rows. Checks
+// they all draw the same pixels and collisions, and the same ids where
+// there are any, and that a sprite drawn in more chunks than there are
+// sprites keeps its collisions, e.g.
+//
+//   hstx_dvi_sprite_bench [-c]
+//
+//   -c  only check, without the timings
+//
+// Returns non-zero if a check fails.
+
+#include "hstx_dvi_blit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Sprites drawn into each row
+#define SPRITES_PER_ROW 32
+#define ROWS 4096
+#define PASSES 20
+
+static hstx_dvi_row_t _row[2];
+static SpriteIdRow _idRow[2];
+static SpriteCollisions _collisions[2];
+static SpriteOccupancyRow _occRow;
+static SpriteCollisionMask _masks[MAX_SPRITES];
+
+typedef struct {
+	uint32_t d;
+	int32_t x;
+	SpriteId id;
+	hstx_dvi_pixel_t p;
+} bench_sprite_t;
+
+static bench_sprite_t _bench[ROWS][SPRITES_PER_ROW];
+
+// The pixel at a time loop, as it was in render_sprite_row_n_p1
+static void __attribute__((noinline)) pixel_sprite_row(
+	const uint32_t d,
+	const hstx_dvi_pixel_t p,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const SpriteId spriteId,
+	const uint32_t w,
+	SpriteIdRow* const idRow,
+	SpriteCollisions* const frameCollisions
+) {
+	if (d)
+	{
+		const SpriteCollisionMask spriteCollisionMask = _masks[spriteId];
+		SpriteCollisionMask* const spriteCollisionsPtr = &frameCollisions->m[spriteId];
+		const uint32_t bm = 1 << (w-1);
+		const uint32_t ux = (uint32_t)x;
+		for (int32_t i = 0; i < w; i++)
+		{
+			const uint32_t j = ux + i;
+			if ((j < MODE_H_ACTIVE_PIXELS) && (d & (bm >> i)))
+			{
+				const SpriteId ncid = idRow->id[j];
+				if (ncid)
+				{
+					const SpriteId cid = ncid - 1;
+					frameCollisions->m[cid] |= spriteCollisionMask;
+					*spriteCollisionsPtr |= _masks[cid];
+				}
+				else
+				{
+					hstx_dvi_row_set_pixel(r, j, p);
+					idRow->id[j] = spriteId + 1;
+				}
+			}
+		}
+	}
+}
+
+#if MODE_BITS_PER_PIXEL >= 8
+static void __attribute__((noinline)) word_sprite_row(
+	const uint32_t d,
+	const hstx_dvi_pixel_t p,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const SpriteId spriteId,
+	const uint32_t w,
+	SpriteIdRow* const idRow,
+	SpriteCollisions* const frameCollisions
+) {
+	if (d) hstx_dvi_blit_sprite_row(d, w, p, r, x, spriteId, idRow, frameCollisions, _masks);
+}
+#else
+// No id row blitter below 8 bits per pixel, the renderer uses the pixel loop
+#define word_sprite_row pixel_sprite_row
+#endif
+
+static void __attribute__((noinline)) bitmap_sprite_row(
+	const uint32_t d,
+	const hstx_dvi_pixel_t p,
+	hstx_dvi_row_t* r,
+	const int32_t x,
+	const SpriteId spriteId,
+	const uint32_t w,
+	SpriteIdRow* const idRow,
+	SpriteCollisions* const frameCollisions
+) {
+	if (d) hstx_dvi_blit_sprite_row_bitmap(d, w, p, r, x, spriteId, &_occRow, frameCollisions, _masks);
+}
+
+typedef void (*sprite_row_fn)(
+	uint32_t, hstx_dvi_pixel_t, hstx_dvi_row_t*, int32_t, SpriteId, uint32_t,
+	SpriteIdRow*, SpriteCollisions*);
+
+// As clear_sprite_id_row would
+static void clear_id_row(const uint32_t k) {
+	memset(&_idRow[k], 0, sizeof(_idRow[k]));
+}
+
+static void clear_occ_row(const uint32_t k) {
+	memset(_occRow.occ, 0, sizeof(_occRow.occ));
+	_occRow.n = 0;
+}
+
+typedef struct {
+	sprite_row_fn fn;
+	void (*clear)(uint32_t k);
+} bench_variant_t;
+
+static const bench_variant_t _pixel = { pixel_sprite_row, clear_id_row };
+static const bench_variant_t _word = { word_sprite_row, clear_id_row };
+static const bench_variant_t _bitmap = { bitmap_sprite_row, clear_occ_row };
+
+static void draw_row(const bench_variant_t* v, const uint32_t k, const uint32_t y, const uint32_t w, const uint32_t n) {
+	v->clear(k);
+	for (uint32_t s = 0; s < n; ++s) {
+		const bench_sprite_t* b = &_bench[y][s];
+		v->fn(b->d, b->p, &_row[k], b->x, b->id, w, &_idRow[k], &_collisions[k]);
+	}
+}
+
+static bool same_row(const bool ids) {
+	return !memcmp(&_row[0], &_row[1], sizeof(_row[0])) &&
+		!memcmp(&_collisions[0], &_collisions[1], sizeof(_collisions[0])) &&
+		(!ids || !memcmp(&_idRow[0], &_idRow[1], sizeof(_idRow[0])));
+}
+
+static void reset(const uint32_t k) {
+	memset(&_row[k], 0, sizeof(_row[k]));
+	memset(&_collisions[k], 0, sizeof(_collisions[k]));
+}
+
+// Collisions are cleared once a frame rather than once a row, so leave them
+// out of the time
+static double time_ns(const bench_variant_t* v, const uint32_t w, const uint32_t n) {
+	struct timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (uint32_t p = 0; p < PASSES; ++p) {
+		for (uint32_t y = 0; y < ROWS; ++y) draw_row(v, 0, y, w, n);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	const double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+	return ns / ((double)PASSES * ROWS * n);
+}
+
+// A group or a zoomed sprite draws a row in chunks. Draw more of them than
+// there are sprites, then land another sprite on the last ones.
+static bool check_chunked_row() {
+	const SpriteId group = 1;
+	const SpriteId other = 2;
+	const uint32_t chunks = MAX_SPRITES + 45;
+	const bench_variant_t* const v[2] = { &_pixel, &_bitmap };
+	for (uint32_t k = 0; k < 2; ++k) {
+		reset(k);
+		v[k]->clear(k);
+		for (uint32_t c = 0; c < chunks; ++c) {
+			v[k]->fn(0x3, (hstx_dvi_pixel_t)c, &_row[k], 2 * c, group, 2, &_idRow[k], &_collisions[k]);
+		}
+		v[k]->fn(0xff, 0, &_row[k], 2 * chunks - 4, other, 8, &_idRow[k], &_collisions[k]);
+	}
+	return same_row(false) &&
+		(_collisions[1].m[group] & _masks[other]) &&
+		(_collisions[1].m[other] & _masks[group]);
+}
+
+int main(int argc, char** argv) {
+	const bool timed = !(argc > 1 && !strcmp(argv[1], "-c"));
+	srand(1);
+	for (uint32_t i = 0; i < MAX_SPRITES; ++i) _masks[i] = 1u << (i & 31);
+
+	int rc = 0;
+	if (!check_chunked_row()) {
+		printf("a sprite drawn in %u chunks lost its collision, bitmap\n", (uint)(MAX_SPRITES + 45));
+		rc = 1;
+	}
+	static const uint32_t widths[] = { 8, 16, 32 };
+	static const uint32_t counts[] = { 4, SPRITES_PER_ROW };
+	if (timed) {
+		printf("%u bits per pixel, ns per sprite row\n", MODE_BITS_PER_PIXEL);
+		printf("width  sprites  pixel   word bitmap\n");
+	}
+	for (uint32_t wi = 0; wi < count_of(widths); ++wi) {
+		const uint32_t w = widths[wi];
+		// Random bits and places, some of them off either edge. Every
+		// sprite on a row has its own id, as it would in a frame.
+		for (uint32_t y = 0; y < ROWS; ++y) {
+			for (uint32_t s = 0; s < SPRITES_PER_ROW; ++s) {
+				bench_sprite_t* b = &_bench[y][s];
+				b->d = ((uint32_t)rand() << 16 ^ (uint32_t)rand()) & (w == 32 ? ~0u : (1u << w) - 1);
+				b->x = (rand() % (MODE_H_ACTIVE_PIXELS + 2 * w)) - (int32_t)w;
+				b->id = (y * SPRITES_PER_ROW + s) % MAX_SPRITES;
+				b->p = rand();
+			}
+		}
+		for (uint32_t ci = 0; ci < count_of(counts); ++ci) {
+			const uint32_t n = counts[ci];
+			// They must all draw the same thing
+			for (uint32_t y = 0; y < ROWS; ++y) {
+				reset(0);
+				draw_row(&_pixel, 0, y, w, n);
+				reset(1);
+				draw_row(&_word, 1, y, w, n);
+				if (!same_row(true)) {
+					printf("width %u row %u differs, word\n", w, y);
+					rc = 1;
+					break;
+				}
+				reset(1);
+				draw_row(&_bitmap, 1, y, w, n);
+				if (!same_row(false)) {
+					printf("width %u row %u differs, bitmap\n", w, y);
+					rc = 1;
+					break;
+				}
+			}
+			if (timed) {
+				printf("%5u %8u %6.1f %6.1f %6.1f\n", w, n,
+					time_ns(&_pixel, w, n), time_ns(&_word, w, n), time_ns(&_bitmap, w, n));
+			}
+		}
+	}
+	return rc;
+}